@@ -32,6 +32,7 @@ struct parameter
 	int *weight_label;
 	double* weight;
 	double p;
+	int nr_thread;		/* threads for one-vs-rest training of nr_class > 2 classes */
 };
 
 struct model
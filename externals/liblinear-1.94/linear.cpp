@@ -22,6 +22,19 @@ template <class S, class T> static inline void clone(T*& dst, S* src, int n)
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 #define INF HUGE_VAL
 
+// Random numbers for coordinate descent permutations. Solvers get rand()
+// unless the calling thread has set its own generator state: one-vs-rest
+// training gives every class a generator seeded by class index, so the
+// model doesn't depend on number of threads and their scheduling.
+static thread_local unsigned long long *rand_state = NULL;
+static int linear_rand()
+{
+	if(rand_state == NULL)
+		return rand();
+	*rand_state = *rand_state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (int)((*rand_state >> 33) & 0x7fffffff);
+}
+
 static void print_string_stdout(const char *s)
 {
 	fputs(s,stdout);
@@ -586,7 +599,7 @@ void Solver_MCSVM_CS::Solve(double *w)
 		double stopping = -INF;
 		for(i=0;i<active_size;i++)
 		{
-			int j = i+rand()%(active_size-i);
+			int j = i+linear_rand()%(active_size-i);
 			swap(index[i], index[j]);
 		}
 		for(s=0;s<active_size;s++)
@@ -848,7 +861,7 @@ static void solve_l2r_l1l2_svc(
 
 		for (i=0; i<active_size; i++)
 		{
-			int j = i+rand()%(active_size-i);
+			int j = i+linear_rand()%(active_size-i);
 			swap(index[i], index[j]);
 		}
 
@@ -1056,7 +1069,7 @@ static void solve_l2r_l1l2_svr(
 
 		for(i=0; i<active_size; i++)
 		{
-			int j = i+rand()%(active_size-i);
+			int j = i+linear_rand()%(active_size-i);
 			swap(index[i], index[j]);
 		}
 
@@ -1276,7 +1289,7 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 	{
 		for (i=0; i<l; i++)
 		{
-			int j = i+rand()%(l-i);
+			int j = i+linear_rand()%(l-i);
 			swap(index[i], index[j]);
 		}
 		int newton_iter = 0;
@@ -1457,7 +1470,7 @@ static void solve_l1r_l2_svc(
 
 		for(j=0; j<active_size; j++)
 		{
-			int i = j+rand()%(active_size-j);
+			int i = j+linear_rand()%(active_size-j);
 			swap(index[i], index[j]);
 		}
 
@@ -1832,7 +1845,7 @@ static void solve_l1r_lr(
 
 			for(j=0; j<QP_active_size; j++)
 			{
-				int i = j+rand()%(QP_active_size-j);
+				int i = j+linear_rand()%(QP_active_size-j);
 				swap(index[i], index[j]);
 			}
 
@@ -2388,26 +2401,37 @@ model* train(const problem *prob, const parameter *param)
 			else
 			{
 				model_->w=Malloc(double, w_size*nr_class);
-				double *w=Malloc(double, w_size);
+				// classes are independent: every class has its own labels,
+				// weights and random generator, so they may be trained in parallel
+				int nr_thread = param->nr_thread > 1 ? param->nr_thread : 1;
+#pragma omp parallel for schedule(dynamic) num_threads(nr_thread)
 				for(i=0;i<nr_class;i++)
 				{
 					int si = start[i];
 					int ei = si+count[i];
 
-					k=0;
-					for(; k<si; k++)
-						sub_prob.y[k] = -1;
-					for(; k<ei; k++)
-						sub_prob.y[k] = +1;
-					for(; k<sub_prob.l; k++)
-						sub_prob.y[k] = -1;
+					problem class_prob = sub_prob;
+					class_prob.y = Malloc(double,class_prob.l);
+					double *w=Malloc(double, w_size);
 
-					train_one(&sub_prob, param, w, weighted_C[i], param->C);
+					int kk=0;
+					for(; kk<si; kk++)
+						class_prob.y[kk] = -1;
+					for(; kk<ei; kk++)
+						class_prob.y[kk] = +1;
+					for(; kk<class_prob.l; kk++)
+						class_prob.y[kk] = -1;
+
+					unsigned long long class_rand_state = (unsigned long long)i + 1;
+					rand_state = &class_rand_state;
+					train_one(&class_prob, param, w, weighted_C[i], param->C);
+					rand_state = NULL;
 
 					for(int j=0;j<w_size;j++)
 						model_->w[j*nr_class+i] = w[j];
+					free(w);
+					free(class_prob.y);
 				}
-				free(w);
 			}
 
 		}
@@ -2439,7 +2463,7 @@ void cross_validation(const problem *prob, const parameter *param, int nr_fold,
 	for(i=0;i<l;i++) perm[i]=i;
 	for(i=0;i<l;i++)
 	{
-		int j = i+rand()%(l-i);
+		int j = i+linear_rand()%(l-i);
 		swap(perm[i],perm[j]);
 	}
 	for(i=0;i<=nr_fold;i++)
@@ -2801,6 +2825,9 @@ const char *check_parameter(const problem *prob, const parameter *param)
 	if(param->p < 0)
 		return "p < 0";
 
+	if(param->nr_thread < 1)
+		return "nr_thread < 1";
+
 	if(param->solver_type != L2R_LR
 		&& param->solver_type != L2R_L2LOSS_SVC_DUAL
 		&& param->solver_type != L2R_L2LOSS_SVC
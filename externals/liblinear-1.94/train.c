@@ -186,6 +186,7 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 	param.nr_weight = 0;
 	param.weight_label = NULL;
 	param.weight = NULL;
+	param.nr_thread = 1;
 	flag_cross_validation = 0;
 	bias = -1;
 
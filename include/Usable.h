@@ -1,12 +1,12 @@
 #pragma once
 
 #include "matrix.h"
-#include "EasyBMP.h"
+#include "decoder.h"
+#include "index_sequence.h"
 #include <assert.h>
 
-Matrix<double> grayscale(BMP &img);
-
-Matrix<std::tuple<uint, uint, uint>> origin(BMP &img);
+// Grayscale plane of image (computed once by decoder) as doubles
+Matrix<double> grayscale(const TImage &img);
 
 template <typename T>
 class ConvolutionOp
@@ -16,7 +16,7 @@ public:
     uint radius = 0;
     uint &vert_radius = radius, &hor_radius = radius;
     ConvolutionOp(const Matrix<double> &kernel);
-    T operator()(const Matrix<T> &neighbourhood) const;
+    T operator()(const Neighbourhood<T> &neighbourhood) const;
 };
 
 template <typename T>
@@ -25,22 +25,24 @@ class CompareOp
 public:
     uint radius = 1;
     uint &vert_radius = radius, &hor_radius = radius;
-    uint8_t operator()(const Matrix<T> &neighbourhood) const;
+    uint8_t operator()(const Neighbourhood<T> &neighbourhood) const;
 };
 
 template <typename T>
-uint8_t CompareOp<T>::operator()(const Matrix<T> &neighbourhood) const
+uint8_t CompareOp<T>::operator()(const Neighbourhood<T> &neighbourhood) const
 {
     // matrices "multiplication"
     assert(neighbourhood.n_cols == neighbourhood.n_rows);
     assert(radius == 1);
 
+    const T center = neighbourhood.row(1)[1];
     uint8_t sum = 0;
     for (uint i = 0; i < 3 ; i++) {
+        const T *line = neighbourhood.row(i);
         for (uint j = 0; j < 3; j++) {
-            if (i != 1 && j != 1) {
+            if (i != 1 || j != 1) {
                 sum <<= 1;
-                sum += (neighbourhood(1, 1) <= neighbourhood(i, j));
+                sum += (center <= line[j]);
             }
         }
     }
@@ -59,38 +61,132 @@ Matrix<double> sobel_x(const Matrix<double> &src_image);
 
 Matrix<double> sobel_y(const Matrix<double> &src_image);
 
+// How gradient magnitude is assigned to orientation bins:
+// Hard - all of it goes to the sector of gradient direction;
+// Soft - it is split between two bins whose centers are nearest, in
+// proportion to distances to them (measured by cross products, which is
+// close to, but not exactly, proportion of angles).
+enum class OrientationBinning : uint8_t { Hard, Soft };
+
+// Sobel gradients of image: projections, absolute values and
+// orientation bins.
+struct Gradient
+{
+    Matrix<double> x, y, abs;
+    /// direction [-pi, pi] split into nBins equal sectors
+    Matrix<uint8_t> bin;
+    /// Soft binning only (empty otherwise): share of abs going to bin
+    /// (bin + 1) % nBins, the rest goes to bin
+    Matrix<double> share;
+};
+
+// Same projections as sobel_x and sobel_y, but image is read once and all
+// outputs are written in one sweep over rows. Pixels outside of image
+// are given by view (no padded copy is made), Matrix is seen with
+// mirrored borders.
+// Vectorized (SSE2/AVX2) kernel is selected at runtime.
+// Bins are found without atan2: direction is compared with sector
+// boundaries by signs of cross products, nBins must be even.
+Gradient sobelGradient(const BorderedView<double> &src_image, uint nBins,
+                       OrientationBinning binning = OrientationBinning::Hard);
+Gradient sobelGradient(const Matrix<double> &src_image, uint nBins,
+                       OrientationBinning binning = OrientationBinning::Hard);
+
+// LBP codes of the whole image in one pass: the same as
+// unary_map(CompareOp<uint8_t>{}) for Matrix (borders are mirrored),
+// views give their own borders and padding; bits of 8
+// neighbours go in raster order, the top left one is the highest.
+// Cells of image take slices of the result, so pixels on cell edges
+// see their real neighbours.
+// Vectorized (SSE2/AVX2) kernel is selected at runtime, it compares
+// a whole register of pixels with every neighbour at once.
+Matrix<uint8_t> lbpCodes(const BorderedView<uint8_t> &src_image);
+Matrix<uint8_t> lbpCodes(const Matrix<uint8_t> &src_image);
+
+// How LBP codes are counted in histograms:
+// Full - every code has its own bin (256 bins);
+// Uniform - codes with at most 2 bit transitions around the circle have
+//     own bins (58), all others share one (59 bins);
+// RotationInvariant - uniform codes are binned by number of ones (9),
+//     all others share one (10 bins).
+enum class LbpMode : uint8_t { Full, Uniform, RotationInvariant };
+
+constexpr uint lbpBins(LbpMode mode)
+{
+    return mode == LbpMode::Full ? 256 : mode == LbpMode::Uniform ? 59 : 10;
+}
+
+// Bits of lbpCodes go in raster order, around the circle (clockwise from
+// the top left neighbour) they are 7, 6, 5, 3, 0, 1, 2, 4.
+constexpr uint lbpCircleBit(uint code, uint k)
+{
+    return (code >> (k % 8 == 0 ? 7 : k % 8 == 1 ? 6 : k % 8 == 2 ? 5 : k % 8 == 3 ? 3 :
+                     k % 8 == 4 ? 0 : k % 8 == 5 ? 1 : k % 8 == 6 ? 2 : 4)) & 1;
+}
+
+constexpr uint lbpTransitions(uint code, uint k = 0)
+{
+    return k == 8 ? 0 : (lbpCircleBit(code, k) != lbpCircleBit(code, k + 1)) + lbpTransitions(code, k + 1);
+}
+
+constexpr uint lbpOnes(uint code)
+{
+    return code == 0 ? 0 : (code & 1) + lbpOnes(code >> 1);
+}
+
+// Position on the circle where the run of ones of uniform code starts
+constexpr uint lbpRunStart(uint code, uint k = 0)
+{
+    return k == 8 ? 0 : (lbpCircleBit(code, k) && !lbpCircleBit(code, k + 7)) ? k : lbpRunStart(code, k + 1);
+}
+
+// Uniform bins: 0 and 1 for all zeros and all ones, then 8 rotations
+// for every number of ones from 1 to 7, the last bin is for the rest
+constexpr uint lbpBin(LbpMode mode, uint code)
+{
+    return mode == LbpMode::Full ? code :
+           lbpTransitions(code) > 2 ? lbpBins(mode) - 1 :
+           mode == LbpMode::RotationInvariant ? lbpOnes(code) :
+           lbpOnes(code) == 0 ? 0 :
+           lbpOnes(code) == 8 ? 1 :
+           2 + (lbpOnes(code) - 1) * 8 + lbpRunStart(code);
+}
+
+// Bins of all 256 codes, generated at compile time
+template <LbpMode Mode, typename Seq = typename MakeIndexSequence<256>::type> struct LbpLut;
+template <LbpMode Mode, uint... I>
+struct LbpLut<Mode, IndexSequence<I...>>
+{
+    static constexpr uint8_t bins[sizeof...(I)] = {static_cast<uint8_t>(lbpBin(Mode, I))...};
+};
+template <LbpMode Mode, uint... I>
+constexpr uint8_t LbpLut<Mode, IndexSequence<I...>>::bins[sizeof...(I)];
+
+inline const uint8_t *lbpLut(LbpMode mode)
+{
+    return mode == LbpMode::Full ? LbpLut<LbpMode::Full>::bins :
+           mode == LbpMode::Uniform ? LbpLut<LbpMode::Uniform>::bins :
+           LbpLut<LbpMode::RotationInvariant>::bins;
+}
+
 template <typename T>
 ConvolutionOp<T>::ConvolutionOp(const Matrix<double> &kernel) : kernel_(kernel),
                                                                 radius((kernel.n_rows - 1) / 2) {}
 
 template <typename T>
-T ConvolutionOp<T>::operator()(const Matrix<T> &neighbourhood) const
+T ConvolutionOp<T>::operator()(const Neighbourhood<T> &neighbourhood) const
 {
     // matrices "multiplication"
     assert(neighbourhood.n_cols == neighbourhood.n_rows);
     assert(radius == (neighbourhood.n_cols - 1) / 2);
 
     T sum = 0;
-    for (size_t i = 0; i < 2 * radius + 1 ; i++) {
-        for (size_t j = 0; j < 2 * radius + 1; j++) {
-            sum += neighbourhood(i, j) * kernel_(i, j);
+    for (uint i = 0; i < 2 * radius + 1 ; i++) {
+        const T *line = neighbourhood.row(i);
+        const double *kernelLine = kernel_.row(i);
+        for (uint j = 0; j < 2 * radius + 1; j++) {
+            sum += line[j] * kernelLine[j];
         }
     }
     return sum;
 }
-
-template <typename T>
-Matrix<T> extraMatrix(const Matrix<T> &src, uint newNRows, uint newNCols)
-{
-    Matrix<T> ans(newNRows, newNCols);
-    for (uint i = 0; i < ans.n_rows; i++) {
-        for (uint j = 0; j < ans.n_cols; j++) {
-            if (i < src.n_rows && j < src.n_cols) {
-                ans(i, j) = src(i, j);
-            } else {
-                ans(i, j) = T{};
-            }
-        }
-    }
-    return ans;
-}
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// Blocking FIFO queue of limited capacity for producer-consumer pipelines.
+// Producer blocks while queue is full, so memory taken by queued items is
+// bounded by capacity.
+//
+// Example:
+// BoundedQueue<int> queue(4);
+// std::thread producer([&] { for (int i = 0; i < 10; ++i) queue.push(i); queue.close(); });
+// int item;
+// while (queue.pop(item)) std::cout << item;
+// producer.join();
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity);
+
+	BoundedQueue(const BoundedQueue &) = delete;
+	BoundedQueue &operator = (const BoundedQueue &) = delete;
+
+	// Wait for free space and put item into queue.
+	// Returns false (and drops item) if queue has been closed.
+	bool push(T item);
+
+	// Wait for item and take it from queue.
+	// Returns false if queue is closed and there are no items left.
+	bool pop(T &item);
+
+	// Take item if there is one right now, never waits.
+	// Consumers use it to drain a batch of items after blocking pop().
+	bool try_pop(T &item);
+
+	// No more items will be pushed. Wakes up all waiting threads.
+	// Consumers still get items which are already in queue.
+	void close();
+
+private:
+	const size_t capacity_;
+	std::deque<T> items_;
+	bool closed_;
+	std::mutex mutex_;
+	std::condition_variable not_full_;
+	std::condition_variable not_empty_;
+};
+
+template<typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) :
+	capacity_{ capacity ? capacity : 1 },
+	items_{},
+	closed_{ false },
+	mutex_{},
+	not_full_{},
+	not_empty_{}
+{
+}
+
+template<typename T>
+bool BoundedQueue<T>::push(T item)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+		if (closed_)
+			return false;
+		items_.push_back(std::move(item));
+	}
+	not_empty_.notify_one();
+	return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::pop(T &item)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+		if (items_.empty())
+			return false;
+		item = std::move(items_.front());
+		items_.pop_front();
+	}
+	not_full_.notify_one();
+	return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::try_pop(T &item)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (items_.empty())
+			return false;
+		item = std::move(items_.front());
+		items_.pop_front();
+	}
+	not_full_.notify_one();
+	return true;
+}
+
+template<typename T>
+void BoundedQueue<T>::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+	}
+	not_full_.notify_all();
+	not_empty_.notify_all();
+}
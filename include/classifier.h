@@ -4,46 +4,104 @@
 #include <vector>
 #include <string>
 #include <cstdlib>
+#include <cmath>
 #include <iostream>
 #include <memory>
+#include <algorithm>
 
 #include "linear.h"
+#include "feature_matrix.h"
+#include "scoring.h"
+#include "model_file.h"
 
 using std::vector;
 using std::pair;
 using std::string;
 
-typedef vector<pair<vector<float>, int> > TFeatures;
 typedef vector<int> TLabels;
 
 // Model of classifier to be trained
-// Encapsulates 'struct model' from liblinear
+// Encapsulates 'struct model' from liblinear or binary model mapped from file
 class TModel {
         // Pointer to liblinear model;
     std::unique_ptr<struct model, decltype(std::free) *> model_;
+        // Binary model mapped from file
+    std::unique_ptr<TMappedModel> mapped_;
+        // Class-major copy of liblinear model weights
+    vector<double> weights_storage_;
+        // Weights used by prediction, point to 'weights_storage_' or to mapped file
+    TModelWeights weights_;
+        // Version of feature extractor model is trained with, 0 if unknown
+    uint32_t extractor_version_;
+
+        // Take weights from liblinear model
+    void UpdateWeights() {
+        mapped_.reset();
+        weights_ = TModelWeights();
+        weights_storage_.clear();
+        if (model_.get())
+            TransposeWeights(model_.get(), &weights_storage_, &weights_);
+    }
  public:
         // Basic constructor
-    TModel(): model_(NULL, std::free) {}
+    TModel(): model_(NULL, std::free), mapped_(), weights_storage_(), weights_(), extractor_version_(0) {}
         // Construct class by liblinear model
-    TModel(struct model* model): model_(model, std::free) {}
+    TModel(struct model* model): model_(model, std::free), mapped_(), weights_storage_(), weights_(),
+        extractor_version_(0) {
+        UpdateWeights();
+    }
         // Operator = for liblinear model
     TModel& operator=(struct model* model) {
         model_ = std::unique_ptr<struct model, decltype(std::free) *>(model, std::free);
+        UpdateWeights();
         return *this;
     }
-        // Save model to file
-    void Save(const string& model_file) const {
+        // Save model to file in liblinear text format, extractor version
+        // is appended after liblinear data
+    bool Save(const string& model_file) const {
         assert(model_.get());
-        save_model(model_file.c_str(), model_.get());
+        if (save_model(model_file.c_str(), model_.get()) != 0) {
+            std::cerr << "Error! Can't write model " << model_file << std::endl;
+            return false;
+        }
+        return AppendExtractorVersion(model_file, extractor_version_);
+    }
+        // Save model to file in binary format
+    bool SaveBinary(const string& model_file) const {
+        assert(weights_.w);
+        return SaveBinaryModel(model_file, weights_, extractor_version_);
     }
-        // Load model from file
+        // Load model from file, binary models are mapped and used in place
     void Load(const string& model_file) {
-        model_ = std::unique_ptr<struct model, decltype(std::free) *>(load_model(model_file.c_str()), std::free);
+        if (IsBinaryModelFile(model_file)) {
+            model_.reset();
+            UpdateWeights();
+            mapped_.reset(new TMappedModel(model_file));
+            if (mapped_->Valid())
+                weights_ = mapped_->Weights();
+            extractor_version_ = mapped_->ExtractorVersion();
+        } else {
+            model_ = std::unique_ptr<struct model, decltype(std::free) *>(load_model(model_file.c_str()), std::free);
+            UpdateWeights();
+            extractor_version_ = ReadExtractorVersion(model_file);
+        }
+    }
+        // Remember version of feature extractor model is trained with
+    void SetExtractorVersion(uint32_t extractor_version) {
+        extractor_version_ = extractor_version;
     }
-        // Get pointer to liblinear model
+        // Version of feature extractor model is trained with, 0 if unknown
+    uint32_t ExtractorVersion() const {
+        return extractor_version_;
+    }
+        // Get pointer to liblinear model, null for binary models
     struct model* get() const {
         return model_.get();
     }
+        // Get weights for prediction
+    const TModelWeights& Weights() const {
+        return weights_;
+    }
 };
 
 // Parameters for classifier training
@@ -56,6 +114,7 @@ struct TClassifierParams {
     int nr_weight;
     int* weight_label;
     double* weight;
+    int nr_thread;
 
     TClassifierParams() {
         bias = -1;
@@ -65,6 +124,7 @@ struct TClassifierParams {
         nr_weight = 0;
         weight_label = NULL;
         weight = NULL;
+        nr_thread = 1;
     }
 };
 
@@ -78,34 +138,40 @@ class TClassifier {
     TClassifier(const TClassifierParams& params): params_(params) {}
 
         // Train classifier
-    void Train(const TFeatures& features, TModel* model) {
+    void Train(const TFeatureMatrix& features, TModel* model) {
             // Number of samples and features must be nonzero
-        size_t number_of_samples = features.size();
+        size_t number_of_samples = features.Size();
         assert(number_of_samples > 0);
 
-        size_t number_of_features = features[0].first.size();
+        size_t number_of_features = features.Dim();
         assert(number_of_features > 0);
 
+            // Nodes of all samples are stored in one arena. Zero features are
+            // skipped: liblinear treats missing features as zeros, and LBP
+            // histograms are mostly zero
+        size_t number_of_nodes = 0;
+        for (size_t sample_idx = 0; sample_idx < number_of_samples; ++sample_idx)
+            number_of_nodes += CountNonZero(features.Row(sample_idx), number_of_features) + 1;
+        vector<struct feature_node> nodes(number_of_nodes);
+        vector<struct feature_node*> x(number_of_samples);
+        vector<double> y(number_of_samples);
+
+            // Fill nodes and labels
+        struct feature_node* node = nodes.data();
+        for (size_t sample_idx = 0; sample_idx < number_of_samples; ++sample_idx)
+        {
+            x[sample_idx] = node;
+            node = FillNodes(features.Row(sample_idx), number_of_features, node);
+            y[sample_idx] = features.Label(sample_idx);
+        }
+
             // Description of one problem
         struct problem prob;
         prob.l = number_of_samples;
         prob.bias = -1;
         prob.n = number_of_features;
-        prob.y = new double[number_of_samples];
-        prob.x = new struct feature_node*[number_of_samples];
-
-            // Fill struct problem
-        for (size_t sample_idx = 0; sample_idx < number_of_samples; ++sample_idx)
-        {
-            prob.x[sample_idx] = new struct feature_node[number_of_features + 1];
-            for (unsigned int feature_idx = 0; feature_idx < number_of_features; feature_idx++)
-            {
-                prob.x[sample_idx][feature_idx].index = feature_idx + 1;
-                prob.x[sample_idx][feature_idx].value = features[sample_idx].first[feature_idx];
-            }
-            prob.x[sample_idx][number_of_features].index = -1;
-            prob.y[sample_idx] = features[sample_idx].second;
-        }
+        prob.y = y.data();
+        prob.x = x.data();
 
             // Fill param structure by values from 'params_'
         struct parameter param;
@@ -115,38 +181,114 @@ class TClassifier {
         param.nr_weight = params_.nr_weight;
         param.weight_label = params_.weight_label;
         param.weight = params_.weight;
+        param.nr_thread = params_.nr_thread;  // one-vs-rest classes are trained in parallel
 
             // Train model
         *model = train(&prob, &param);
 
             // Clear param structure
         destroy_param(&param);
-            // clear problem structure
-        delete[] prob.y;
-        for (unsigned int sample_idx = 0; sample_idx < number_of_samples; ++sample_idx)
-            delete[] prob.x[sample_idx];
-        delete[] prob.x;
     }
 
-        // Predict data
-    void Predict(const TFeatures& features, const TModel& model, TLabels* labels) {
+        // Predict data. All samples are scored at once against dense model
+        // weights (in place for mapped binary models), no liblinear node
+        // lists are built. If 'dec_values' is given it receives decision
+        // values, row-major, one row per sample with one value per weight
+        // row of model (a single value for two-class models except MCSVM_CS,
+        // as in liblinear).
+        // Returns false without predicting anything if model was trained on
+        // descriptors of other dimension: their features would be scored
+        // against weights of other features.
+    bool Predict(const TFeatureMatrix& features, const TModel& model, TLabels* labels,
+                 vector<double>* dec_values = NULL) {
             // Number of samples and features must be nonzero
-        size_t number_of_samples = features.size();
+        size_t number_of_samples = features.Size();
         assert(number_of_samples > 0);
-        size_t number_of_features = features[0].first.size();
-        assert(number_of_features > 0);
+        assert(features.Dim() > 0);
+
+        const TModelWeights& weights = model.Weights();
+        assert(weights.w);
+        if (features.Dim() != weights.nr_feature)
+            return false;
+        size_t nr_w = weights.nr_w;
+        size_t n = features.Dim();
+
+            // Decision values start from the bias term
+        vector<double> local_dec;
+        vector<double>& dec = dec_values ? *dec_values : local_dec;
+        dec.assign(number_of_samples * nr_w, 0);
+        if (weights.bias >= 0)
+            for (size_t sample_idx = 0; sample_idx < number_of_samples; ++sample_idx)
+                for (size_t class_idx = 0; class_idx < nr_w; ++class_idx)
+                    dec[sample_idx * nr_w + class_idx] =
+                        weights.w[class_idx * weights.w_stride + weights.nr_feature] * weights.bias;
+
+        ScoreDense(features, weights.w, weights.w_stride, nr_w, n, dec.data());
+
+            // Labels are chosen from decision values as in liblinear predict_values:
+            // regression models (they always have two classes) return decision value,
+            // two-class models compare the first value with zero (even MCSVM_CS, which
+            // has two values), others take class with maximal value
+        int solver_type = weights.solver_type;
+        bool regression = solver_type == L2R_L2LOSS_SVR || solver_type == L2R_L2LOSS_SVR_DUAL ||
+                          solver_type == L2R_L1LOSS_SVR_DUAL;
+        size_t nr_class = weights.nr_class;
+        size_t first_label = labels->size();
+        labels->reserve(first_label + number_of_samples);
+        for (size_t sample_idx = 0; sample_idx < number_of_samples; ++sample_idx) {
+            const double* sample_dec = dec.data() + sample_idx * nr_w;
+            if (regression) {
+                labels->push_back(static_cast<int>(sample_dec[0]));
+            } else if (nr_class == 2) {
+                labels->push_back(sample_dec[0] > 0 ? weights.label[0] : weights.label[1]);
+            } else {
+                size_t best = std::max_element(sample_dec, sample_dec + nr_class) - sample_dec;
+                labels->push_back(weights.label[best]);
+            }
+        }
+
+#ifdef DEBUG
+            // Dense scoring must agree with liblinear, check it whenever liblinear model is at hand
+        if (model.get()) {
+            vector<struct feature_node> nodes(features.Dim() + 2);
+            for (size_t sample_idx = 0; sample_idx < number_of_samples; ++sample_idx) {
+                struct feature_node* end = FillNodes(features.Row(sample_idx), features.Dim(), nodes.data());
+                if (weights.bias >= 0) {
+                        // bias node goes before terminator, as liblinear predict expects
+                    end[-1].index = static_cast<int>(weights.nr_feature + 1);
+                    end[-1].value = weights.bias;
+                    end->index = -1;
+                }
+                assert(static_cast<int>(predict(model.get(), nodes.data())) == (*labels)[first_label + sample_idx]);
+            }
+        }
+#endif
+        return true;
+    }
+
+ private:
+        // Number of nonzero values among 'number_of_features' values of 'row'
+    static size_t CountNonZero(const float* row, size_t number_of_features) {
+        size_t count = 0;
+        for (size_t feature_idx = 0; feature_idx < number_of_features; ++feature_idx)
+            count += std::fpclassify(row[feature_idx]) != FP_ZERO;
+        return count;
+    }
 
-            // Fill struct problem
-        struct feature_node* x = new struct feature_node[number_of_features + 1];
-        for (size_t sample_idx = 0; sample_idx < features.size(); ++sample_idx) {
-            for (unsigned int feature_idx = 0; feature_idx < number_of_features; ++feature_idx) {
-                x[feature_idx].index = feature_idx + 1;
-                x[feature_idx].value = features[sample_idx].first[feature_idx];
+        // Write nonzero features of 'row' as liblinear nodes to 'node' and terminate them.
+        // Returns pointer past the terminator.
+    static struct feature_node* FillNodes(const float* row, size_t number_of_features,
+                                          struct feature_node* node) {
+        for (size_t feature_idx = 0; feature_idx < number_of_features; ++feature_idx) {
+            if (std::fpclassify(row[feature_idx]) != FP_ZERO) {
+                node->index = static_cast<int>(feature_idx + 1);
+                node->value = row[feature_idx];
+                ++node;
             }
-            x[number_of_features].index = -1;
-                // Add predicted label to labels structure
-            labels->push_back(predict(model.get(), x));
         }
+        node->index = -1;
+        ++node;
+        return node;
     }
 };
 
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+#include "image.h"
+#include "EasyBMP.h"
+
+// Channels of color planes of TImage
+enum TColorChannel : uint { RED_CHANNEL = 0, GREEN_CHANNEL = 1, BLUE_CHANNEL = 2 };
+
+// Image decoded into contiguous row-major color planes.
+// Row 0 is the top row of the picture, so plane(i, j) is pixel (x = j, y = i).
+struct TImage
+{
+    /// red, green and blue planes, see TColorChannel
+    Image<uint8_t, 3> rgb;
+    /// Grayscale, computed by decoder together with color planes,
+    /// so all extractors share it
+    Matrix<uint8_t> gray;
+};
+
+// Integer grayscale weights (sum is less than 256, so result fits uint8_t):
+// gray = (R * 59 + G * 150 + B * 37 + 128) / 256,
+// the same as 0.229 * R + 0.587 * G + 0.144 * B within rounding.
+constexpr uint16_t GRAY_R_WEIGHT = 59, GRAY_G_WEIGHT = 150, GRAY_B_WEIGHT = 37;
+
+// Decode BMP file into planes.
+// Uncompressed 24 and 32-bit files (the usual case) are decoded row by row
+// straight from the file buffer; any other format is read by EasyBMP and
+// converted. Returns false if file can't be read, in this case image is
+// whatever EasyBMP left after failure (1x1 picture), as it was before.
+bool DecodeBmp(const std::string &file_name, TImage *image);
+
+// Same, but content of file 'file_name' is already read into 'buffer'.
+bool DecodeBmp(const std::vector<uint8_t> &buffer, const std::string &file_name, TImage *image);
+
+// Read whole file into 'buffer'. Returns false if file can't be read.
+bool ReadFileBytes(const std::string &file_name, std::vector<uint8_t> *buffer);
+
+// Convert image which is already loaded by EasyBMP.
+TImage ImageFromBmp(BMP &img);
+
+// Convert raw pixels: nRows x nCols interleaved R, G, B bytes, top row first.
+TImage ImageFromRgb(const uint8_t *rgb, uint nRows, uint nCols);
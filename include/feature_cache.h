@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 64-bit FNV-1a hash of bytes, used as key of image content.
+uint64_t HashBytes(const uint8_t *data, size_t size, uint64_t seed = 14695981039346656037ULL);
+
+// On-disk cache of image descriptors.
+// Descriptors are keyed by hash of image file content, so renamed or
+// copied files still hit the cache. The whole file is tagged by key of
+// extractor configuration: if configuration has changed, old entries are
+// ignored and the file is rewritten on Save().
+//
+// File format (host byte order, cache is a local artifact):
+// magic "MG2FEATC", uint32 format version, uint64 config key, uint64 entry count,
+// then entries: uint64 content hash, uint32 dimension, float[dimension].
+//
+// Lookup and Insert are thread-safe.
+class TFeatureCache {
+ public:
+        // Load cache from 'cache_file' if it exists and was built with 'config_key'
+    TFeatureCache(const std::string& cache_file, uint64_t config_key);
+
+        // Find descriptor of 'dim' features of image with content hash 'content_hash'
+        // and copy it to 'desc'
+    bool Lookup(uint64_t content_hash, float* desc, size_t dim) const;
+        // Remember descriptor of 'dim' features of image with content hash 'content_hash'
+    void Insert(uint64_t content_hash, const float* desc, size_t dim);
+
+        // Write cache to file if there are new entries
+    void Save() const;
+
+ private:
+    std::string cache_file_;
+    uint64_t config_key_;
+    std::unordered_map<uint64_t, std::vector<float>> entries_;
+    bool modified_;
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,83 @@
+#ifndef FEATURE_MATRIX_H_
+#define FEATURE_MATRIX_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Dense descriptors of a dataset: one contiguous block of
+// Size() x Dim() floats (row per sample) and an array of labels.
+// Every row starts at ALIGNMENT-byte boundary and is padded with zeros
+// up to Stride() floats, so vector kernels may read whole rows.
+class TFeatureMatrix {
+ public:
+        // Alignment of rows in bytes (cache line, enough for AVX)
+    static constexpr size_t ALIGNMENT = 64;
+
+        // Empty matrix
+    TFeatureMatrix(): size_(0), dim_(0), stride_(0), storage_(), data_(nullptr), labels_() {}
+        // Matrix of 'n_samples' zero rows of 'dim' features, labels are zero
+    TFeatureMatrix(size_t n_samples, size_t dim): TFeatureMatrix() {
+        Resize(n_samples, dim);
+    }
+
+    TFeatureMatrix(const TFeatureMatrix&) = delete;
+    TFeatureMatrix& operator=(const TFeatureMatrix&) = delete;
+    TFeatureMatrix(TFeatureMatrix&&) = default;
+    TFeatureMatrix& operator=(TFeatureMatrix&&) = default;
+
+        // Reallocate matrix for 'n_samples' rows of 'dim' features, all values are zero
+    void Resize(size_t n_samples, size_t dim) {
+        constexpr size_t FLOATS_PER_LINE = ALIGNMENT / sizeof(float);
+        size_ = n_samples;
+        dim_ = dim;
+        stride_ = (dim + FLOATS_PER_LINE - 1) / FLOATS_PER_LINE * FLOATS_PER_LINE;
+            // over-allocate to align the first row
+        size_t total = size_ * stride_ + FLOATS_PER_LINE;
+        storage_.reset(new float[total]());
+        void* ptr = storage_.get();
+        size_t space = total * sizeof(float);
+        data_ = static_cast<float*>(std::align(ALIGNMENT, size_ * stride_ * sizeof(float), ptr, space));
+        labels_.assign(size_, 0);
+    }
+
+        // Number of samples
+    size_t Size() const { return size_; }
+        // Number of features of one sample
+    size_t Dim() const { return dim_; }
+        // Distance between rows in floats
+    size_t Stride() const { return stride_; }
+
+        // Features of sample 'idx', Dim() values
+    float* Row(size_t idx) {
+        assert(idx < size_);
+        return data_ + idx * stride_;
+    }
+    const float* Row(size_t idx) const {
+        assert(idx < size_);
+        return data_ + idx * stride_;
+    }
+
+        // Label of sample 'idx'
+    int& Label(size_t idx) {
+        assert(idx < size_);
+        return labels_[idx];
+    }
+    int Label(size_t idx) const {
+        assert(idx < size_);
+        return labels_[idx];
+    }
+
+ private:
+    size_t size_;
+    size_t dim_;
+    size_t stride_;
+    std::unique_ptr<float[]> storage_;
+    float* data_;
+    std::vector<int> labels_;
+};
+
+#endif
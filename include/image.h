@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+
+#include "matrix.h"
+#include "index_sequence.h"
+
+// Planar (structure of arrays) image of C channels: every channel is a
+// Matrix plane of the same size, so each plane is contiguous and vector
+// kernels stream channels one by one instead of striding over pixels.
+//
+// Semantics are those of Matrix: copies and submatrices share pixels,
+// submatrix is a view with the same stride.
+//
+// Example:
+// Image<uint8_t, 3> rgb(480, 640);
+// rgb.row(0, 10)[20] = 255;                  // red of pixel (x = 20, y = 10)
+// auto cell = rgb.submatrix(0, 0, 60, 80);   // view, nothing is copied
+template<typename ValueT, uint C>
+class Image
+{
+public:
+	static constexpr uint n_channels = C;
+	// Size of every plane
+	const uint n_rows, n_cols;
+
+	// Empty image
+	Image();
+	// Image of given size, pixels are not initialized
+	Image(uint row_count, uint col_count);
+	// Image made of existing planes, which must have equal sizes. Pixels are shared.
+	explicit Image(const std::array<Matrix<ValueT>, C> &planes);
+	Image(const Image &) = default;
+	// Pixels are shared, as in Matrix
+	const Image &operator = (const Image &);
+
+	// Plane of channel c
+	const Matrix<ValueT> &plane(uint c) const;
+	Matrix<ValueT> &plane(uint c);
+
+	// Row i of channel c, see Matrix::row
+	const ValueT *row(uint c, uint i) const;
+	ValueT *row(uint c, uint i);
+
+	// View of rows x cols pixels at (prow, pcol) in all channels, see Matrix::submatrix
+	const Image submatrix(uint prow, uint pcol, uint rows, uint cols) const;
+
+private:
+	template<uint... I>
+	static std::array<Matrix<ValueT>, C> make_planes(uint row_count, uint col_count, IndexSequence<I...>);
+	template<uint... I>
+	static std::array<Matrix<ValueT>, C> sub_planes(const std::array<Matrix<ValueT>, C> &planes,
+		uint prow, uint pcol, uint rows, uint cols, IndexSequence<I...>);
+
+	std::array<Matrix<ValueT>, C> planes_;
+};
+
+template<typename ValueT, uint C>
+constexpr uint Image<ValueT, C>::n_channels;
+
+template<typename ValueT, uint C>
+template<uint... I>
+std::array<Matrix<ValueT>, C> Image<ValueT, C>::make_planes(uint row_count, uint col_count, IndexSequence<I...>)
+{
+	// Matrix has no default constructor, so planes are built in place
+	return std::array<Matrix<ValueT>, C>{{ (static_cast<void>(I), Matrix<ValueT>(row_count, col_count))... }};
+}
+
+template<typename ValueT, uint C>
+template<uint... I>
+std::array<Matrix<ValueT>, C> Image<ValueT, C>::sub_planes(const std::array<Matrix<ValueT>, C> &planes,
+	uint prow, uint pcol, uint rows, uint cols, IndexSequence<I...>)
+{
+	return std::array<Matrix<ValueT>, C>{{ planes[I].submatrix(prow, pcol, rows, cols)... }};
+}
+
+template<typename ValueT, uint C>
+Image<ValueT, C>::Image() :
+	Image(0, 0)
+{
+}
+
+template<typename ValueT, uint C>
+Image<ValueT, C>::Image(uint row_count, uint col_count) :
+	n_rows{ row_count },
+	n_cols{ col_count },
+	planes_(make_planes(row_count, col_count, typename MakeIndexSequence<C>::type()))
+{
+}
+
+template<typename ValueT, uint C>
+Image<ValueT, C>::Image(const std::array<Matrix<ValueT>, C> &planes) :
+	n_rows{ planes[0].n_rows },
+	n_cols{ planes[0].n_cols },
+	planes_(planes)
+{
+	for (uint c = 0; c < C; ++c)
+		assert(planes_[c].n_rows == n_rows && planes_[c].n_cols == n_cols);
+}
+
+template<typename ValueT, uint C>
+const Image<ValueT, C> &Image<ValueT, C>::operator = (const Image<ValueT, C> &img)
+{
+	// public sizes are const for users, as in Matrix
+	const_cast<uint &>(n_rows) = img.n_rows;
+	const_cast<uint &>(n_cols) = img.n_cols;
+	planes_ = img.planes_;
+	return *this;
+}
+
+template<typename ValueT, uint C>
+const Matrix<ValueT> &Image<ValueT, C>::plane(uint c) const
+{
+	assert(c < C);
+	return planes_[c];
+}
+
+template<typename ValueT, uint C>
+Matrix<ValueT> &Image<ValueT, C>::plane(uint c)
+{
+	assert(c < C);
+	return planes_[c];
+}
+
+template<typename ValueT, uint C>
+const ValueT *Image<ValueT, C>::row(uint c, uint i) const
+{
+	return plane(c).row(i);
+}
+
+template<typename ValueT, uint C>
+ValueT *Image<ValueT, C>::row(uint c, uint i)
+{
+	return plane(c).row(i);
+}
+
+template<typename ValueT, uint C>
+const Image<ValueT, C> Image<ValueT, C>::submatrix(uint prow, uint pcol, uint rows, uint cols) const
+{
+	return Image(sub_planes(planes_, prow, pcol, rows, cols, typename MakeIndexSequence<C>::type()));
+}
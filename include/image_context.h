@@ -0,0 +1,76 @@
+#pragma once
+
+#include <memory>
+
+#include "decoder.h"
+#include "integral_image.h"
+#include "Usable.h"
+
+// Grid of square cells over image padded with zeros up to multiple of
+// cells_per_line in both directions. Padding is virtual: kernels see it
+// through BorderedView, no padded copies are made.
+struct TCellGrid {
+        // Padded size
+    uint n_rows, n_cols;
+    uint cells_per_line;
+        // Size of one cell
+    uint cell_rows, cell_cols;
+
+        // Call f(prow, pcol, rows, cols) for every cell, row by row
+    template <typename F>
+    void ForEachCell(F f) const {
+        for (uint i = 0; i < cells_per_line; ++i)
+            for (uint j = 0; j < cells_per_line; ++j)
+                f(i * cell_rows, j * cell_cols, cell_rows, cell_cols);
+    }
+};
+
+// Intermediate results of one image shared by descriptor extractors:
+//
+//   pixels -> gray as doubles -> gradients -> orientation integrals
+//   pixels -> LBP codes
+//   pixels -> color integrals
+//
+// Gradients and codes are computed over the cell grid area, which is
+// padded with zeros and has mirrored borders.
+//
+// Every node is computed on first request (with the nodes it depends on)
+// and kept while the context lives, so each extractor just asks for what
+// it needs and common work is done at most once per image. New descriptor
+// pays only for the nodes nobody has asked for before.
+// Not thread-safe: one image is processed by one thread.
+class TImageContext {
+ public:
+        // Context of 'image', which must outlive it
+    TImageContext(const TImage& image, uint cells_per_line, uint orientation_bins,
+                  OrientationBinning binning);
+
+    TImageContext(const TImageContext&) = delete;
+    TImageContext& operator=(const TImageContext&) = delete;
+
+        // Decoded pixels
+    const TImage& Pixels() const { return image_; }
+    const TCellGrid& Grid() const { return grid_; }
+        // Grayscale of image size as doubles
+    const Matrix<double>& GrayDouble();
+        // Sobel gradients and orientation bins over grid area
+    const Gradient& Gradients();
+        // Summed-area tables of gradient magnitude, channel per orientation bin
+    const IntegralImage<double>& OrientationIntegrals();
+        // LBP codes over grid area
+    const Matrix<uint8_t>& LbpCodes();
+        // Summed-area tables of color planes (padding counts as zeros)
+    const IntegralImage<uint64_t>& ColorIntegrals();
+
+ private:
+    const TImage& image_;
+    const uint orientation_bins_;
+    const OrientationBinning binning_;
+        // cheap, so computed at once
+    TCellGrid grid_;
+    std::unique_ptr<Matrix<double>> gray_double_;
+    std::unique_ptr<Gradient> gradients_;
+    std::unique_ptr<IntegralImage<double>> orientation_integrals_;
+    std::unique_ptr<Matrix<uint8_t>> lbp_codes_;
+    std::unique_ptr<IntegralImage<uint64_t>> color_integrals_;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+typedef unsigned int uint;
+
+// Compile-time sequence 0, 1, ..., N - 1 for expanding packs over indices
+// (std::index_sequence is C++14).
+//
+// Example:
+// template <uint... I> std::array<int, sizeof...(I)> squares(IndexSequence<I...>)
+// { return {{ (I * I)... }}; }
+// auto table = squares(MakeIndexSequence<8>::type());
+template <uint... I> struct IndexSequence {};
+template <uint N, uint... I> struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+template <uint... I> struct MakeIndexSequence<0, I...> { typedef IndexSequence<I...> type; };
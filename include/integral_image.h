@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "matrix.h"
+#include "image.h"
+
+// Summed-area table of image with one or several channels.
+// Table is built in one pass over rows, after that the sum of any
+// rectangle costs four lookups per channel, so cells of any grid or
+// sliding windows don't rescan pixels.
+//
+// Channels are interleaved, so sums of all channels of a rectangle are
+// read from four contiguous runs. Pixels outside of image count as zeros
+// (like zero padding of BorderedView), rectangles may go past the borders.
+//
+// Example:
+// Matrix<uint8_t> gray = ...;
+// IntegralImage<uint64_t> table(gray);
+// uint64_t cell = table.sum(8, 8, 16, 16);
+template<typename SumT>
+class IntegralImage
+{
+public:
+	// Image size and number of channels
+	const uint n_rows, n_cols, n_channels;
+
+	// Build table of rows x cols image. fill_row(i, values) is called for
+	// every row in order and writes values of its pixels to zeroed
+	// 'values': cols * channels values, channel c of pixel j at j * channels + c.
+	template<typename RowFiller>
+	IntegralImage(uint rows, uint cols, uint channels, RowFiller fill_row);
+
+	// Single channel table of matrix
+	template<typename ValueT>
+	explicit IntegralImage(const Matrix<ValueT> &src);
+	// Table of all channels of planar image
+	template<typename ValueT, uint C>
+	explicit IntegralImage(const Image<ValueT, C> &src);
+
+	// Sum of channel over rectangle of rows x cols pixels at (prow, pcol)
+	SumT sum(uint prow, uint pcol, uint rows, uint cols, uint channel = 0) const;
+	// Sums of all channels over rectangle, n_channels values are written to out
+	void sum(uint prow, uint pcol, uint rows, uint cols, SumT *out) const;
+
+private:
+	// (n_rows + 1) x (n_cols + 1) * n_channels table, first row and
+	// first pixel of every row are zeros:
+	// table_(i, j * C + c) = sum of channel c over [0, i) x [0, j)
+	Matrix<SumT> table_;
+};
+
+template<typename SumT>
+template<typename RowFiller>
+IntegralImage<SumT>::IntegralImage(uint rows, uint cols, uint channels, RowFiller fill_row) :
+	n_rows{ rows },
+	n_cols{ cols },
+	n_channels{ channels },
+	table_((rows + 1), (cols + 1) * channels)
+{
+	const uint width = (n_cols + 1) * n_channels;
+	std::fill(table_.row(0), table_.row(0) + width, SumT{});
+	std::vector<SumT> values(n_cols * n_channels);
+	std::vector<SumT> running(n_channels);
+	for (uint i = 0; i < n_rows; ++i) {
+		std::fill(values.begin(), values.end(), SumT{});
+		fill_row(i, values.data());
+		std::fill(running.begin(), running.end(), SumT{});
+		const SumT *above = table_.row(i);
+		SumT *dst = table_.row(i + 1);
+		std::fill(dst, dst + n_channels, SumT{});
+		for (uint j = 0; j < n_cols; ++j) {
+			for (uint c = 0; c < n_channels; ++c) {
+				running[c] += values[j * n_channels + c];
+				dst[(j + 1) * n_channels + c] = above[(j + 1) * n_channels + c] + running[c];
+			}
+		}
+	}
+}
+
+template<typename SumT>
+template<typename ValueT>
+IntegralImage<SumT>::IntegralImage(const Matrix<ValueT> &src) :
+	IntegralImage(src.n_rows, src.n_cols, 1, [&src](uint i, SumT *values) {
+		const ValueT *line = src.row(i);
+		std::copy(line, line + src.n_cols, values);
+	})
+{
+}
+
+template<typename SumT>
+template<typename ValueT, uint C>
+IntegralImage<SumT>::IntegralImage(const Image<ValueT, C> &src) :
+	IntegralImage(src.n_rows, src.n_cols, C, [&src](uint i, SumT *values) {
+		// planes are read one by one, each of them is contiguous
+		for (uint c = 0; c < C; ++c) {
+			const ValueT *line = src.row(c, i);
+			for (uint j = 0; j < src.n_cols; ++j)
+				values[j * C + c] = line[j];
+		}
+	})
+{
+}
+
+template<typename SumT>
+SumT IntegralImage<SumT>::sum(uint prow, uint pcol, uint rows, uint cols, uint channel) const
+{
+	const uint r0 = std::min(prow, n_rows), r1 = std::min(prow + rows, n_rows);
+	const uint c0 = std::min(pcol, n_cols), c1 = std::min(pcol + cols, n_cols);
+	const SumT *top = table_.row(r0), *bottom = table_.row(r1);
+	return bottom[c1 * n_channels + channel] - bottom[c0 * n_channels + channel]
+		- top[c1 * n_channels + channel] + top[c0 * n_channels + channel];
+}
+
+template<typename SumT>
+void IntegralImage<SumT>::sum(uint prow, uint pcol, uint rows, uint cols, SumT *out) const
+{
+	const uint r0 = std::min(prow, n_rows), r1 = std::min(prow + rows, n_rows);
+	const uint c0 = std::min(pcol, n_cols), c1 = std::min(pcol + cols, n_cols);
+	const SumT *top = table_.row(r0), *bottom = table_.row(r1);
+	for (uint c = 0; c < n_channels; ++c) {
+		out[c] = bottom[c1 * n_channels + c] - bottom[c0 * n_channels + c]
+			- top[c1 * n_channels + c] + top[c0 * n_channels + c];
+	}
+}
@@ -5,11 +5,74 @@
 #include <tuple>
 #include <memory>
 #include <iostream>
+#include <iterator>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 typedef unsigned int uint;
 
+template<typename ValueT>
+class Matrix;
+
+template<typename ValueT>
+class BorderedView;
+
+template<typename Derived>
+class MatrixExpr;
+
+// See thread_pool.h, needed by parallel unary_map only
+class ThreadPool;
+
+// Lightweight non-owning window into memory of some matrix: raw pointer
+// to the first element plus stride. Unlike submatrix it doesn't copy
+// shared_ptr, so it is cheap to create one for every pixel.
+// Window is valid while matrix it was taken from is alive.
+template<typename ValueT>
+class Neighbourhood
+{
+public:
+	// Number of rows
+	const uint n_rows;
+	// Number of cols
+	const uint n_cols;
+
+	Neighbourhood(const ValueT *pin, uint stride, uint row_count, uint col_count);
+
+	// Same as Matrix indexing, bounds are checked only in DEBUG build
+	const ValueT &operator() (uint row, uint col) const;
+	// Pointer to the first element of row i
+	const ValueT *row(uint i) const;
+
+private:
+	const ValueT *pin_;
+	const uint stride_;
+};
+
+// Tells how unary_map has to call operator Op on matrix of ValueT.
+// Operators which take Neighbourhood<ValueT> get raw window, operators
+// which take Matrix<ValueT> get submatrix as before (adapter for
+// operators written against old interface).
+template<typename Op, typename ValueT>
+struct stencil_traits
+{
+	template<typename O>
+	static auto test(int) -> decltype(std::declval<O &>()(std::declval<const Neighbourhood<ValueT> &>()),
+	                                  std::true_type());
+	template<typename O>
+	static std::false_type test(...);
+
+	typedef decltype(test<Op>(0)) takes_window;
+	typedef typename std::conditional<takes_window::value,
+		Neighbourhood<ValueT>, Matrix<ValueT>>::type argument_type;
+};
+
+// Type returned by Op applied to neighbourhood of ValueT pixel.
+// Alias (not a member of stencil_traits) to keep unary_map SFINAE-friendly.
+template<typename Op, typename ValueT>
+using stencil_result_t = typename std::result_of<
+	Op &(const typename stencil_traits<Op, ValueT>::argument_type &)>::type;
+
 template<typename ValueT>
 class Matrix
 {
@@ -48,6 +111,15 @@ public:
 	// It is from c++ 11 standard.
 	Matrix(Matrix && );
 
+	// Evaluate lazy arithmetic expression of matrices (see matrix_expr.h)
+	// in one loop over pixels, no temporaries are made.
+	// Defined in matrix_expr.h, include it to use expressions.
+	//
+	// Example:
+	// Matrix<double> magnitude = sqrt(gx * gx + gy * gy);
+	template<typename Expr>
+	Matrix(const MatrixExpr<Expr> &expr);
+
 	// Desctructor, yeah.
 	~Matrix();
 
@@ -63,11 +135,20 @@ public:
 	// cout << a; // 9 3 7
 	ValueT &operator() (uint row, uint col);
 
+	// Row access for hot loops. Returns pointer to the first element of
+	// row i, elements of one row are contiguous:
+	// a.row(i)[j] is the same element as a(i, j) for j < n_cols.
+	// Bounds are checked only if DEBUG is defined, so kernels don't pay
+	// for a branch per pixel in release build.
+	const ValueT *row(uint i) const;
+	ValueT *row(uint i);
+
 	// Matrix convolution.
 	//
 	// You give this function a unary operator. Operator _must_
-	// have radius field and function
-	// operator()(const Matrix<ValueT> neighbourhood).
+	// have vert_radius and hor_radius fields and function
+	// operator()(const Neighbourhood<ValueT> &neighbourhood)
+	// (or, slower, operator()(const Matrix<ValueT> neighbourhood)).
 	// For every pixel of that matrix this function takes
 	// neighbourhood of that pixel of size
 	// (2 * radius + 1) x (2 * radius + 1), applies operator to that
@@ -77,36 +158,53 @@ public:
 	// Function unary map returns a matrix of
 	Matrix <
 		// type which is returned
-		typename std::result_of <
+		stencil_result_t <
 		// by operator applied to neighbourhood of pixel
-		UnaryMatrixOperator(Matrix<ValueT>)
-		> ::type
+		const UnaryMatrixOperator, ValueT
+		>
 	>
 	unary_map(const UnaryMatrixOperator &op) const;
 
-
-	//return new matrix with mirror borders
-	Matrix<ValueT> extra_borders(uint kernel_vert_radius, uint kernel_hor_radius) const;
-
 	// Same, but unary operator is mutable.
 	// If you take operator with mutable fields, you can
 	// make statistic computations using unary map
 	// (statistics like sum of pixel values or histograms of pixel values)
 	template<typename UnaryMatrixOperator>
-	Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+	Matrix<stencil_result_t<UnaryMatrixOperator, ValueT>>
 		unary_map(UnaryMatrixOperator &op) const;
 
-	// binary_map has the same idea as unary_map,
-	// but now operator takes two neighbourhoods. For example,
-	// if radius = 0, you can make operator, which make elementwise
-	// product of two matrices.
+	// Parallel unary_map. Result is split into tiles of
+	// map_tile_rows x map_tile_cols pixels, whose neighbourhoods fit in
+	// cache, and tiles are processed by workers of pool. All workers call
+	// the same op, so its operator() must be safe to call concurrently
+	// (ConvolutionOp and other operators without mutable state are).
+	// Result is the same as of sequential unary_map.
+	// Like ThreadPool::parallel_for, it may be called from a job of pool.
+	// Defined in matrix_parallel.h, include it to use parallel overloads.
+	template<typename UnaryMatrixOperator>
+	Matrix<stencil_result_t<const UnaryMatrixOperator, ValueT>>
+		unary_map(const UnaryMatrixOperator &op, ThreadPool &pool) const;
+
+	// Parallel unary_map with mutable operator. Every tile is processed by
+	// its own copy of op, then copies are merged into op by
+	// reduce(op, tile_op) in row-major order of tiles, so statistics don't
+	// depend on scheduling of workers.
 	//
-	// This function isn't implemented, if you understood unary_map, using its
-	// code you can easily implement binary_map.
-	template<typename BinaryMatrixOperator>
-	friend Matrix<ValueT> binary_map(const BinaryMatrixOperator&,
-		const Matrix<ValueT>&,
-		const Matrix<ValueT>&);
+	// Example (histogram operator with 'hist' field):
+	// m.unary_map(hist_op, pool, [](HistOp &total, const HistOp &part) {
+	//     for (uint k = 0; k < total.hist.size(); ++k)
+	//         total.hist[k] += part.hist[k];
+	// });
+	template<typename UnaryMatrixOperator, typename Reduce>
+	Matrix<stencil_result_t<UnaryMatrixOperator, ValueT>>
+		unary_map(UnaryMatrixOperator &op, ThreadPool &pool, Reduce reduce) const;
+
+	// Tile size of parallel unary_map
+	static const uint map_tile_rows = 32;
+	static const uint map_tile_cols = 256;
+
+	// binary_map and zip_map (see below) have the same idea as unary_map,
+	// but operator takes pixels or neighbourhoods of several matrices.
 
 	// Get sumbmatrix of matrix
 	// Remember that indexing starts at 0!
@@ -120,6 +218,38 @@ public:
 	const Matrix<ValueT> submatrix(uint prow, uint pcol,
 		uint rows, uint cols) const;
 
+	// Same as submatrix, but returns non-owning window.
+	// Bounds are checked only in DEBUG build.
+	Neighbourhood<ValueT> window(uint prow, uint pcol,
+		uint rows, uint cols) const;
+
+private:
+	// Common part of both unary_map overloads. Op may be const.
+	template<typename Op>
+	Matrix<stencil_result_t<Op, ValueT>>
+		stencil_map(Op &op) const;
+
+	// Apply op to neighbourhoods of pixels of rows [row_begin, row_end)
+	// and cols [col_begin, col_end), writing results to dst.
+	// Neighbourhoods crossing borders are mirrored through view into
+	// scratch of kernel size.
+	template<typename Op>
+	void stencil_tile(Op &op, const BorderedView<ValueT> &view, Matrix<stencil_result_t<Op, ValueT>> &dst,
+		uint row_begin, uint row_end, uint col_begin, uint col_end, Matrix<ValueT> &scratch) const;
+
+	// Number of tiles of parallel unary_map, tile_bounds gives pixels of tile idx
+	uint tile_count() const;
+	void tile_bounds(uint idx, uint *row_begin, uint *row_end, uint *col_begin, uint *col_end) const;
+
+	// Apply op to neighbourhood of size rows x cols at (prow, pcol),
+	// passing window or submatrix depending on what op takes.
+	template<typename Op>
+	stencil_result_t<Op, ValueT>
+		apply_at(Op &op, uint prow, uint pcol, uint rows, uint cols, std::true_type) const;
+	template<typename Op>
+	stencil_result_t<Op, ValueT>
+		apply_at(Op &op, uint prow, uint pcol, uint rows, uint cols, std::false_type) const;
+
 private:
 	// Stride - number of elements between two rows (needed for efficient
 	// submatrix function without memory copy)
@@ -154,5 +284,106 @@ std::ostream &operator << (std::ostream &out, const Matrix<ValueT> &m)
 	return out;
 }
 
+// How pixels outside of matrix are seen through BorderedView:
+// Zero - zeros;
+// Clamp - the nearest edge pixel;
+// Mirror - reflection across matrix edge which includes edge pixel
+//          (row -1 is row 0, row -2 is row 1, row n_rows is row n_rows - 1).
+enum class BorderPolicy { Zero, Clamp, Mirror };
+
+// Matrix seen as an unbounded plane without copying it.
+// Inside of logical size n_rows x n_cols pixels are those of source
+// matrix, or zeros where logical size exceeds it (zero padding of cell
+// grid). Pixels outside of logical size follow border policy.
+// Indices are resolved on every at(), so kernels read raw rows of
+// source in the interior and use the view for border pixels only, see
+// for_each_stencil_row. View is valid while source matrix is alive.
+template<typename ValueT>
+class BorderedView
+{
+public:
+	// Logical size
+	const uint n_rows, n_cols;
+	const BorderPolicy policy;
+
+	// View of matrix of its own size
+	BorderedView(const Matrix<ValueT> &src, BorderPolicy border_policy);
+	// View of matrix padded with zeros up to row_count x col_count
+	BorderedView(const Matrix<ValueT> &src, uint row_count, uint col_count, BorderPolicy border_policy);
+
+	const Matrix<ValueT> &source() const;
+
+	// Pixel (row, col), any indices are allowed
+	ValueT at(int row, int col) const;
+
+	// Write rows x cols pixels starting at (prow, pcol) (any of them may be
+	// outside) to dst, rows of dst are dst_stride elements apart
+	void fill(int prow, int pcol, uint rows, uint cols, ValueT *dst, uint dst_stride) const;
+
+private:
+	// Index inside [0, size) or -1 for zero pixel
+	int resolve(int idx, uint size) const;
+
+	const Matrix<ValueT> &src_;
+};
+
+// Run row kernel of stencil with given radii over logical area of view.
+// kernel(rows, i, j0, count) computes outputs of row i, columns
+// [j0, j0 + count); rows are 2 * vert_radius + 1 pointers,
+// rows[k][t] is pixel (i - vert_radius + k, j0 - hor_radius + t).
+// Interior segments get pointers straight into source rows, so the
+// kernel runs there without any checks; border segments get pointers
+// into a small scratch buffer filled according to border policy.
+// No padded copy of the image is made.
+template<typename ValueT, typename RowKernel>
+void for_each_stencil_row(const BorderedView<ValueT> &view, uint vert_radius, uint hor_radius,
+	RowKernel kernel);
+
+// Tells how zip_map has to call operator Op on matrices of ValueTs.
+// Operators which take pixel values are elementwise (radius 0),
+// others take Neighbourhood of every matrix.
+template<typename Op, typename... ValueTs>
+struct zip_traits
+{
+	template<typename O>
+	static auto test(int) -> decltype(std::declval<const O &>()(std::declval<const ValueTs &>()...),
+	                                  std::true_type());
+	template<typename O>
+	static std::false_type test(...);
+
+	typedef decltype(test<Op>(0)) elementwise;
+	typedef typename std::conditional<elementwise::value,
+		std::result_of<const Op &(const ValueTs &...)>,
+		std::result_of<const Op &(const Neighbourhood<ValueTs> &...)>>::type::type result_type;
+};
+
+template<typename Op, typename... ValueTs>
+using zip_result_t = typename zip_traits<Op, ValueTs...>::result_type;
+
+// Map over several matrices of equal size, result(i, j) is op applied
+// to pixels (i, j) of all of them.
+//
+// If op takes pixel values, it is elementwise: rows of all matrices are
+// streamed through raw pointers, so simple operators are vectorized by
+// compiler. Lambdas work here.
+// Matrix<double> magnitude = zip_map([](double x, double y) {
+//     return std::sqrt(x * x + y * y);
+// }, gx, gy);
+//
+// Otherwise op works as in unary_map: it must have vert_radius and
+// hor_radius fields and operator()(const Neighbourhood<ValueT> &...)
+// taking neighbourhood of every matrix, borders are mirrored.
+//
+// Throws std::string if sizes of matrices differ.
+template<typename Op, typename ValueT, typename... ValueTs>
+Matrix<zip_result_t<Op, ValueT, ValueTs...>>
+	zip_map(const Op &op, const Matrix<ValueT> &first, const Matrix<ValueTs> &...rest);
+
+// zip_map of two matrices. For example, if radius = 0, you can make
+// operator, which make elementwise product of two matrices.
+template<typename BinaryMatrixOperator, typename ValueT1, typename ValueT2>
+Matrix<zip_result_t<BinaryMatrixOperator, ValueT1, ValueT2>>
+	binary_map(const BinaryMatrixOperator &op, const Matrix<ValueT1> &a, const Matrix<ValueT2> &b);
+
 // Implementation of Matrix class
 #include "matrix.hpp"
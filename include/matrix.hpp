@@ -40,8 +40,7 @@ Matrix<ValueT> Matrix<ValueT>::deep_copy() const
 {
 	Matrix<ValueT> tmp(n_rows, n_cols);
 	for (uint i = 0; i < n_rows; ++i)
-		for (uint j = 0; j < n_cols; ++j)
-			tmp(i, j) = (*this)(i, j);
+		std::copy(row(i), row(i) + n_cols, tmp.row(i));
 	return tmp;
 }
 
@@ -153,6 +152,26 @@ const ValueT &Matrix<ValueT>::operator()(uint row, uint col) const
 	return _data.get()[row * stride + col];
 }
 
+template<typename ValueT>
+ValueT *Matrix<ValueT>::row(uint i)
+{
+#ifdef DEBUG
+	if (i >= n_rows)
+		throw std::string("Out of bounds");
+#endif
+	return _data.get() + (pin_row + i) * stride + pin_col;
+}
+
+template<typename ValueT>
+const ValueT *Matrix<ValueT>::row(uint i) const
+{
+#ifdef DEBUG
+	if (i >= n_rows)
+		throw std::string("Out of bounds");
+#endif
+	return _data.get() + (pin_row + i) * stride + pin_col;
+}
+
 template<typename ValueT>
 Matrix<ValueT>::~Matrix()
 {}
@@ -173,91 +192,334 @@ const Matrix<ValueT> Matrix<ValueT>::submatrix(uint prow, uint pcol,
 }
 
 template<typename ValueT>
-template<typename UnaryMatrixOperator>
-Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
-	Matrix<ValueT>::unary_map(const UnaryMatrixOperator &op) const
+Neighbourhood<ValueT> Matrix<ValueT>::window(uint prow, uint pcol,
+	uint rows, uint cols) const
+{
+#ifdef DEBUG
+	if (prow + rows > n_rows || pcol + cols > n_cols)
+		throw std::string("Out of bounds");
+#endif
+	return Neighbourhood<ValueT>(_data.get() + (pin_row + prow) * stride + pin_col + pcol,
+		stride, rows, cols);
+}
+
+template<typename ValueT>
+template<typename Op>
+stencil_result_t<Op, ValueT>
+	Matrix<ValueT>::apply_at(Op &op, uint prow, uint pcol, uint rows, uint cols, std::true_type) const
+{
+	return op(window(prow, pcol, rows, cols));
+}
+
+template<typename ValueT>
+template<typename Op>
+stencil_result_t<Op, ValueT>
+	Matrix<ValueT>::apply_at(Op &op, uint prow, uint pcol, uint rows, uint cols, std::false_type) const
+{
+	return op(submatrix(prow, pcol, rows, cols));
+}
+
+template<typename ValueT>
+template<typename Op>
+Matrix<stencil_result_t<Op, ValueT>>
+	Matrix<ValueT>::stencil_map(Op &op) const
 {
 	// Let's typedef return type of function for ease of usage
-	typedef typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type ReturnT;
+	typedef stencil_result_t<Op, ValueT> ReturnT;
 	if (n_cols * n_rows == 0)
 		return Matrix<ReturnT>(0, 0);
 
 	Matrix<ReturnT> tmp(n_rows, n_cols);
+	const BorderedView<ValueT> view(*this, BorderPolicy::Mirror);
+	Matrix<ValueT> scratch(2 * op.vert_radius + 1, 2 * op.hor_radius + 1);
+	stencil_tile(op, view, tmp, 0, n_rows, 0, n_cols, scratch);
+	return tmp;
+}
+
+template<typename ValueT>
+template<typename Op>
+void Matrix<ValueT>::stencil_tile(Op &op, const BorderedView<ValueT> &view,
+	Matrix<stencil_result_t<Op, ValueT>> &dst,
+	uint row_begin, uint row_end, uint col_begin, uint col_end, Matrix<ValueT> &scratch) const
+{
+	typedef stencil_result_t<Op, ValueT> ReturnT;
+	typedef typename stencil_traits<Op, ValueT>::takes_window TakesWindow;
 
-	const auto kernel_vert_radius = op.vert_radius;
-	const auto kernel_hor_radius = op.hor_radius;
+	const uint kernel_vert_radius = op.vert_radius;
+	const uint kernel_hor_radius = op.hor_radius;
+	const uint kernel_rows = 2 * kernel_vert_radius + 1;
+	const uint kernel_cols = 2 * kernel_hor_radius + 1;
 
-	Matrix<ValueT> extra_image = extra_borders(kernel_vert_radius, kernel_hor_radius);
+	// interior pixels see their neighbourhoods right in this matrix,
+	// border ones get a mirrored copy of their neighbourhood only
+	auto in_interior = [](uint idx, uint radius, uint size) {
+		return idx >= radius && idx + radius < size;
+	};
 
-	for (uint i = 0; i < n_rows; ++i) {
-		for (uint j = 0; j < n_cols; ++j) {
-			auto neighbourhood = extra_image.submatrix(i, j, 2 * kernel_vert_radius + 1, 2 * kernel_hor_radius + 1);
-			tmp(i, j) = op(neighbourhood);
+	for (uint i = row_begin; i < row_end; ++i) {
+		ReturnT *line = dst.row(i);
+		const bool interior_row = in_interior(i, kernel_vert_radius, n_rows);
+		for (uint j = col_begin; j < col_end; ++j) {
+			if (interior_row && in_interior(j, kernel_hor_radius, n_cols)) {
+				line[j] = apply_at(op, i - kernel_vert_radius, j - kernel_hor_radius,
+					kernel_rows, kernel_cols, TakesWindow());
+			} else {
+				view.fill(int(i) - int(kernel_vert_radius), int(j) - int(kernel_hor_radius),
+					kernel_rows, kernel_cols, scratch.row(0), kernel_cols);
+				line[j] = scratch.apply_at(op, 0, 0, kernel_rows, kernel_cols, TakesWindow());
+			}
 		}
 	}
-	return tmp;
+}
+
+template<typename ValueT>
+uint Matrix<ValueT>::tile_count() const
+{
+	const uint tile_rows = (n_rows + map_tile_rows - 1) / map_tile_rows;
+	const uint tile_cols = (n_cols + map_tile_cols - 1) / map_tile_cols;
+	return tile_rows * tile_cols;
+}
+
+template<typename ValueT>
+void Matrix<ValueT>::tile_bounds(uint idx, uint *row_begin, uint *row_end, uint *col_begin, uint *col_end) const
+{
+	const uint tile_cols = (n_cols + map_tile_cols - 1) / map_tile_cols;
+	*row_begin = idx / tile_cols * map_tile_rows;
+	*col_begin = idx % tile_cols * map_tile_cols;
+	*row_end = std::min(n_rows, *row_begin + map_tile_rows);
+	*col_end = std::min(n_cols, *col_begin + map_tile_cols);
+}
+
+template<typename ValueT>
+template<typename UnaryMatrixOperator>
+Matrix<stencil_result_t<const UnaryMatrixOperator, ValueT>>
+	Matrix<ValueT>::unary_map(const UnaryMatrixOperator &op) const
+{
+	return stencil_map(op);
 }
 
 template<typename ValueT>
 template<typename UnaryMatrixOperator>
-Matrix<typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type>
+Matrix<stencil_result_t<UnaryMatrixOperator, ValueT>>
 	Matrix<ValueT>::unary_map(UnaryMatrixOperator &op) const
 {
-	typedef typename std::result_of<UnaryMatrixOperator(Matrix<ValueT>)>::type ReturnT;
-	if (n_cols * n_rows == 0)
-		return Matrix<ReturnT>(0, 0);
+	return stencil_map(op);
+}
+
+template<typename ValueT>
+Neighbourhood<ValueT>::Neighbourhood(const ValueT *pin, uint stride, uint row_count, uint col_count) :
+	n_rows{ row_count },
+	n_cols{ col_count },
+	pin_{ pin },
+	stride_{ stride }
+{
+}
+
+template<typename ValueT>
+const ValueT &Neighbourhood<ValueT>::operator()(uint row, uint col) const
+{
+#ifdef DEBUG
+	if (row >= n_rows || col >= n_cols)
+		throw std::string("Out of bounds");
+#endif
+	return pin_[row * stride_ + col];
+}
 
-	Matrix<ReturnT> tmp(n_rows, n_cols);	
+template<typename ValueT>
+const ValueT *Neighbourhood<ValueT>::row(uint i) const
+{
+#ifdef DEBUG
+	if (i >= n_rows)
+		throw std::string("Out of bounds");
+#endif
+	return pin_ + i * stride_;
+}
 
-	const auto kernel_vert_radius = op.vert_radius;
-	const auto kernel_hor_radius = op.hor_radius;
+template<typename ValueT>
+BorderedView<ValueT>::BorderedView(const Matrix<ValueT> &src, BorderPolicy border_policy) :
+	BorderedView(src, src.n_rows, src.n_cols, border_policy)
+{
+}
 
-	Matrix<ValueT> extra_image = extra_borders(kernel_vert_radius, kernel_hor_radius);
+template<typename ValueT>
+BorderedView<ValueT>::BorderedView(const Matrix<ValueT> &src, uint row_count, uint col_count,
+	BorderPolicy border_policy) :
+	n_rows{ row_count },
+	n_cols{ col_count },
+	policy{ border_policy },
+	src_(src)
+{
+}
 
-	for (uint i = 0; i < n_rows; ++i) {
-		for (uint j = 0; j < n_cols; ++j) {
-			auto neighbourhood = extra_image.submatrix(i, j, 2 * kernel_vert_radius + 1, 2 * kernel_hor_radius + 1);
-			tmp(i, j) = op(neighbourhood);
-		}
-	}
-	return tmp;
+template<typename ValueT>
+const Matrix<ValueT> &BorderedView<ValueT>::source() const
+{
+	return src_;
 }
 
 template<typename ValueT>
-Matrix<ValueT> Matrix<ValueT>::extra_borders(uint kernel_vert_radius, uint kernel_hor_radius) const
+int BorderedView<ValueT>::resolve(int idx, uint size) const
 {
-	Matrix<ValueT> extra_image = Matrix<ValueT>(n_rows + 2 * kernel_vert_radius, n_cols + 2 * kernel_hor_radius);
-	for (uint i = 0; i < n_rows; i++) {
-		for (uint j = 0; j < n_cols; j++) {
-			extra_image(i + kernel_vert_radius, j + kernel_hor_radius) = (*this)(i, j);
-		}
+	const int n = static_cast<int>(size);
+	if (idx >= 0 && idx < n)
+		return idx;
+	if (n == 0 || policy == BorderPolicy::Zero)
+		return -1;
+	if (policy == BorderPolicy::Clamp)
+		return idx < 0 ? 0 : n - 1;
+	// mirror, repeatedly if border is wider than image
+	while (idx < 0 || idx >= n)
+		idx = idx < 0 ? -idx - 1 : 2 * n - 1 - idx;
+	return idx;
+}
+
+template<typename ValueT>
+ValueT BorderedView<ValueT>::at(int row, int col) const
+{
+	const int i = resolve(row, n_rows), j = resolve(col, n_cols);
+	// zeros outside by policy or in padding beyond source
+	if (i < 0 || j < 0 || uint(i) >= src_.n_rows || uint(j) >= src_.n_cols)
+		return ValueT{};
+	return src_.row(i)[j];
+}
+
+template<typename ValueT>
+void BorderedView<ValueT>::fill(int prow, int pcol, uint rows, uint cols, ValueT *dst, uint dst_stride) const
+{
+	for (uint i = 0; i < rows; ++i, dst += dst_stride) {
+		for (uint j = 0; j < cols; ++j)
+			dst[j] = at(prow + int(i), pcol + int(j));
 	}
-	//top and bottom
-	for (uint i = 0; i < kernel_vert_radius; i++) {
-		for (uint j = 0; j < n_cols; j++) {
-			extra_image(kernel_vert_radius - i - 1, j + kernel_hor_radius) = (*this)(i, j);
-			extra_image(n_rows + i + kernel_vert_radius, j + kernel_hor_radius) = (*this)(n_rows - 1 - i, j);
+}
+
+template<typename ValueT, typename RowKernel>
+void for_each_stencil_row(const BorderedView<ValueT> &view, uint vert_radius, uint hor_radius,
+	RowKernel kernel)
+{
+	const Matrix<ValueT> &src = view.source();
+	const uint kernel_rows = 2 * vert_radius + 1;
+	// interior: whole neighbourhood is inside of both source and logical area
+	const uint rows_in = std::min(src.n_rows, view.n_rows);
+	const uint cols_in = std::min(src.n_cols, view.n_cols);
+	const uint row_begin = vert_radius, row_end = rows_in > 2 * vert_radius ? rows_in - vert_radius : 0;
+	const uint col_begin = hor_radius, col_end = cols_in > 2 * hor_radius ? cols_in - hor_radius : 0;
+
+	std::vector<ValueT> scratch;
+	std::vector<const ValueT *> rows(kernel_rows);
+	auto run_border = [&](uint i, uint j0, uint count) {
+		const uint width = count + 2 * hor_radius;
+		scratch.resize(kernel_rows * width);
+		view.fill(int(i) - int(vert_radius), int(j0) - int(hor_radius), kernel_rows, width,
+			scratch.data(), width);
+		for (uint k = 0; k < kernel_rows; ++k)
+			rows[k] = scratch.data() + k * width;
+		kernel(rows.data(), i, j0, count);
+	};
+
+	for (uint i = 0; i < view.n_rows; ++i) {
+		if (i < row_begin || i >= row_end || col_begin >= col_end) {
+			run_border(i, 0, view.n_cols);
+			continue;
 		}
+		if (col_begin > 0)
+			run_border(i, 0, col_begin);
+		for (uint k = 0; k < kernel_rows; ++k)
+			rows[k] = src.row(i - vert_radius + k) + col_begin - hor_radius;
+		kernel(rows.data(), i, col_begin, col_end - col_begin);
+		if (col_end < view.n_cols)
+			run_border(i, col_end, view.n_cols - col_end);
 	}
-	//left and right
-	for (uint i = 0; i < n_rows; i++) {
-		for (uint j = 0; j < kernel_hor_radius; j++) {
-			extra_image(i + kernel_vert_radius, kernel_hor_radius - j - 1) = (*this)(i, j);
-			extra_image(i + kernel_vert_radius, n_cols + kernel_hor_radius + j) = (*this)(i, n_cols - 1 - j);
-		}
+}
+
+// Input of stencil zip_map: matrix and scratch for neighbourhoods crossing
+// its borders
+template<typename ValueT>
+class ZipInput
+{
+public:
+	ZipInput(const Matrix<ValueT> &src, uint vert_radius, uint hor_radius) :
+		view_(src, BorderPolicy::Mirror),
+		scratch_(2 * vert_radius + 1, 2 * hor_radius + 1)
+	{
+	}
+
+	// Neighbourhood of kernel size with top left pixel (prow, pcol),
+	// interior ones are taken from matrix directly
+	Neighbourhood<ValueT> window(int prow, int pcol, bool interior)
+	{
+		if (interior)
+			return view_.source().window(prow, pcol, scratch_.n_rows, scratch_.n_cols);
+		view_.fill(prow, pcol, scratch_.n_rows, scratch_.n_cols, scratch_.row(0), scratch_.n_cols);
+		return scratch_.window(0, 0, scratch_.n_rows, scratch_.n_cols);
 	}
-	//corners
-	for (uint i = 0; i < kernel_vert_radius; i++) {
-		for (uint j = 0; j < kernel_hor_radius; j++) {
-			//top-left
-			extra_image(kernel_vert_radius - i - 1, kernel_hor_radius - j - 1) = (*this)(i, j);
-			//bottom-right
-			extra_image(n_rows + kernel_vert_radius + i, n_cols + kernel_hor_radius + j) = (*this)(n_rows - 1 - i, n_cols - 1 - j);
-			//top-right
-			extra_image(kernel_vert_radius - i - 1, n_cols + kernel_hor_radius + j) = (*this)(i, n_cols - 1 - j);
-			//bottom-left
-			extra_image(n_rows + kernel_vert_radius + i, kernel_hor_radius - j - 1) = (*this)(n_rows - 1 - i, j);
+
+private:
+	const BorderedView<ValueT> view_;
+	Matrix<ValueT> scratch_;
+};
+
+template<typename Op, typename ReturnT, typename... ValueTs>
+void zip_row(const Op &op, ReturnT *dst, uint n, const ValueTs *...rows)
+{
+	for (uint j = 0; j < n; ++j)
+		dst[j] = op(rows[j]...);
+}
+
+template<typename Op, typename ReturnT, typename... ValueTs>
+void zip_stencil(const Op &op, Matrix<ReturnT> &dst, ZipInput<ValueTs> &&...inputs)
+{
+	const uint kernel_vert_radius = op.vert_radius;
+	const uint kernel_hor_radius = op.hor_radius;
+	auto in_interior = [](uint idx, uint radius, uint size) {
+		return idx >= radius && idx + radius < size;
+	};
+
+	for (uint i = 0; i < dst.n_rows; ++i) {
+		ReturnT *line = dst.row(i);
+		const bool interior_row = in_interior(i, kernel_vert_radius, dst.n_rows);
+		for (uint j = 0; j < dst.n_cols; ++j) {
+			const bool interior = interior_row && in_interior(j, kernel_hor_radius, dst.n_cols);
+			line[j] = op(inputs.window(int(i) - int(kernel_vert_radius), int(j) - int(kernel_hor_radius),
+				interior)...);
 		}
 	}
-	return extra_image;
+}
+
+template<typename Op, typename ReturnT, typename ValueT, typename... ValueTs>
+void zip_map_into(const Op &op, Matrix<ReturnT> &dst, std::true_type,
+	const Matrix<ValueT> &first, const Matrix<ValueTs> &...rest)
+{
+	for (uint i = 0; i < dst.n_rows; ++i)
+		zip_row(op, dst.row(i), dst.n_cols, first.row(i), rest.row(i)...);
+}
+
+template<typename Op, typename ReturnT, typename ValueT, typename... ValueTs>
+void zip_map_into(const Op &op, Matrix<ReturnT> &dst, std::false_type,
+	const Matrix<ValueT> &first, const Matrix<ValueTs> &...rest)
+{
+	zip_stencil(op, dst, ZipInput<ValueT>(first, op.vert_radius, op.hor_radius),
+		ZipInput<ValueTs>(rest, op.vert_radius, op.hor_radius)...);
+}
+
+template<typename Op, typename ValueT, typename... ValueTs>
+Matrix<zip_result_t<Op, ValueT, ValueTs...>>
+	zip_map(const Op &op, const Matrix<ValueT> &first, const Matrix<ValueTs> &...rest)
+{
+	typedef zip_result_t<Op, ValueT, ValueTs...> ReturnT;
+	const bool same_size[] = { true, (rest.n_rows == first.n_rows && rest.n_cols == first.n_cols)... };
+	if (std::find(std::begin(same_size), std::end(same_size), false) != std::end(same_size))
+		throw std::string("Sizes of matrices differ");
+	if (first.n_rows * first.n_cols == 0)
+		return Matrix<ReturnT>(0, 0);
+
+	Matrix<ReturnT> tmp(first.n_rows, first.n_cols);
+	zip_map_into(op, tmp, typename zip_traits<Op, ValueT, ValueTs...>::elementwise(), first, rest...);
+	return tmp;
+}
+
+template<typename BinaryMatrixOperator, typename ValueT1, typename ValueT2>
+Matrix<zip_result_t<BinaryMatrixOperator, ValueT1, ValueT2>>
+	binary_map(const BinaryMatrixOperator &op, const Matrix<ValueT1> &a, const Matrix<ValueT2> &b)
+{
+	return zip_map(op, a, b);
 }
@@ -0,0 +1,373 @@
+#pragma once
+
+// Expression templates for Matrix arithmetic. Not included by matrix.h:
+// operators and min, max, sqrt, abs and cast below are generic templates,
+// so only files using expressions should see them.
+//
+// Operators on matrices don't compute anything, they build a lazy tree
+// of the expression. Tree is evaluated when it is converted to Matrix or
+// passed to eval_into: one loop over pixels reads all leaves of the tree
+// row by row, so there are no temporary matrices and simple expressions
+// are vectorized by compiler.
+//
+// Example:
+// Matrix<double> magnitude = sqrt(gx * gx + gy * gy);
+// Matrix<uint8_t> clipped = cast<uint8_t>(min(max(image * 1.5 - 20, 0), 255));
+//
+// Supported: +, -, *, / and unary - of matrices, expressions and scalars,
+// sqrt, abs, min, max and cast<T>. Value types follow usual arithmetic
+// conversions, as if the expression was written for single pixels.
+// Call sqrt, abs, min and max unqualified: they are found by argument
+// dependent lookup, while 'using std::min' makes min of two matrices
+// ambiguous.
+//
+// Leaves hold matrices by value. Copy of Matrix is shallow, so it is cheap,
+// and expression stays valid even if it is built from temporary matrices.
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "matrix.h"
+
+// Base of all nodes of expression tree, Derived is the node itself.
+// Every node has value_type, rows(), cols() and row(i) returning a
+// cursor whose operator[](j) is value of pixel (i, j).
+template<typename Derived>
+class MatrixExpr
+{
+public:
+	const Derived &derived() const
+	{
+		return static_cast<const Derived &>(*this);
+	}
+};
+
+// Leaf of expression: matrix
+template<typename ValueT>
+class MatrixLeaf : public MatrixExpr<MatrixLeaf<ValueT>>
+{
+public:
+	typedef ValueT value_type;
+	static const bool is_scalar = false;
+
+	class Row
+	{
+	public:
+		explicit Row(const ValueT *line) : line_(line) {}
+		ValueT operator[](uint j) const { return line_[j]; }
+	private:
+		const ValueT *line_;
+	};
+
+	explicit MatrixLeaf(const Matrix<ValueT> &m) : m_(m) {}
+
+	uint rows() const { return m_.n_rows; }
+	uint cols() const { return m_.n_cols; }
+	Row row(uint i) const { return Row(m_.row(i)); }
+
+private:
+	Matrix<ValueT> m_;
+};
+
+// Leaf of expression: scalar, the same for all pixels. Scalar has no size
+template<typename ValueT>
+class ScalarLeaf : public MatrixExpr<ScalarLeaf<ValueT>>
+{
+public:
+	typedef ValueT value_type;
+	static const bool is_scalar = true;
+
+	class Row
+	{
+	public:
+		explicit Row(ValueT value) : value_(value) {}
+		ValueT operator[](uint) const { return value_; }
+	private:
+		ValueT value_;
+	};
+
+	explicit ScalarLeaf(ValueT value) : value_(value) {}
+
+	uint rows() const { return 0; }
+	uint cols() const { return 0; }
+	Row row(uint) const { return Row(value_); }
+
+private:
+	ValueT value_;
+};
+
+// Node applying Op to value of its operand
+template<typename Op, typename Arg>
+class UnaryExpr : public MatrixExpr<UnaryExpr<Op, Arg>>
+{
+public:
+	typedef decltype(std::declval<Op>()(std::declval<typename Arg::value_type>())) value_type;
+	static const bool is_scalar = Arg::is_scalar;
+
+	class Row
+	{
+	public:
+		explicit Row(const typename Arg::Row &arg) : arg_(arg) {}
+		value_type operator[](uint j) const { return Op()(arg_[j]); }
+	private:
+		typename Arg::Row arg_;
+	};
+
+	explicit UnaryExpr(const Arg &arg) : arg_(arg) {}
+
+	uint rows() const { return arg_.rows(); }
+	uint cols() const { return arg_.cols(); }
+	Row row(uint i) const { return Row(arg_.row(i)); }
+
+private:
+	Arg arg_;
+};
+
+// Node applying Op to values of two operands of equal size (or scalars)
+template<typename Op, typename Left, typename Right>
+class BinaryExpr : public MatrixExpr<BinaryExpr<Op, Left, Right>>
+{
+public:
+	typedef decltype(std::declval<Op>()(std::declval<typename Left::value_type>(),
+	                                    std::declval<typename Right::value_type>())) value_type;
+	static const bool is_scalar = Left::is_scalar && Right::is_scalar;
+
+	class Row
+	{
+	public:
+		Row(const typename Left::Row &left, const typename Right::Row &right) :
+			left_(left), right_(right) {}
+		value_type operator[](uint j) const { return Op()(left_[j], right_[j]); }
+	private:
+		typename Left::Row left_;
+		typename Right::Row right_;
+	};
+
+	BinaryExpr(const Left &left, const Right &right) : left_(left), right_(right)
+	{
+		if (!Left::is_scalar && !Right::is_scalar &&
+			(left_.rows() != right_.rows() || left_.cols() != right_.cols()))
+			throw std::string("Sizes of matrices in expression differ");
+	}
+
+	uint rows() const { return Left::is_scalar ? right_.rows() : left_.rows(); }
+	uint cols() const { return Left::is_scalar ? right_.cols() : left_.cols(); }
+	Row row(uint i) const { return Row(left_.row(i), right_.row(i)); }
+
+private:
+	Left left_;
+	Right right_;
+};
+
+// Operations of nodes
+struct ExprPlus
+{
+	template<typename L, typename R>
+	auto operator()(L l, R r) const -> decltype(l + r) { return l + r; }
+};
+
+struct ExprMinus
+{
+	template<typename L, typename R>
+	auto operator()(L l, R r) const -> decltype(l - r) { return l - r; }
+};
+
+struct ExprMultiplies
+{
+	template<typename L, typename R>
+	auto operator()(L l, R r) const -> decltype(l * r) { return l * r; }
+};
+
+struct ExprDivides
+{
+	template<typename L, typename R>
+	auto operator()(L l, R r) const -> decltype(l / r) { return l / r; }
+};
+
+struct ExprMin
+{
+	template<typename L, typename R>
+	auto operator()(L l, R r) const -> decltype(l + r)
+	{
+		typedef decltype(l + r) T;
+		return T(r) < T(l) ? T(r) : T(l);
+	}
+};
+
+struct ExprMax
+{
+	template<typename L, typename R>
+	auto operator()(L l, R r) const -> decltype(l + r)
+	{
+		typedef decltype(l + r) T;
+		return T(l) < T(r) ? T(r) : T(l);
+	}
+};
+
+struct ExprNegate
+{
+	template<typename T>
+	auto operator()(T v) const -> decltype(-v) { return -v; }
+};
+
+struct ExprSqrt
+{
+	template<typename T>
+	auto operator()(T v) const -> decltype(std::sqrt(v)) { return std::sqrt(v); }
+};
+
+struct ExprAbs
+{
+	template<typename T>
+	auto operator()(T v) const -> decltype(std::abs(v)) { return std::abs(v); }
+};
+
+template<typename To>
+struct ExprCast
+{
+	template<typename T>
+	To operator()(T v) const { return static_cast<To>(v); }
+};
+
+// How operand of expression operator becomes a node: matrices become
+// MatrixLeaf, arithmetic values become ScalarLeaf, nodes stay as they are.
+// No 'type' for other types, so operators don't hijack them.
+template<typename T, typename Enable = void>
+struct expr_node
+{
+};
+
+template<typename ValueT>
+struct expr_node<Matrix<ValueT>, void>
+{
+	typedef MatrixLeaf<ValueT> type;
+	static type make(const Matrix<ValueT> &m) { return type(m); }
+};
+
+template<typename T>
+struct expr_node<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+	typedef ScalarLeaf<T> type;
+	static type make(T value) { return type(value); }
+};
+
+template<typename T>
+struct expr_node<T, typename std::enable_if<std::is_base_of<MatrixExpr<T>, T>::value>::type>
+{
+	typedef T type;
+	static const T &make(const T &node) { return node; }
+};
+
+template<typename T>
+using expr_node_t = typename expr_node<typename std::decay<T>::type>::type;
+
+// Node of Op applied to operands L and R, if they are operands and
+// at least one of them is a matrix or an expression
+template<typename Op, typename L, typename R>
+using binary_expr_t = typename std::enable_if<!(expr_node_t<L>::is_scalar && expr_node_t<R>::is_scalar),
+	BinaryExpr<Op, expr_node_t<L>, expr_node_t<R>>>::type;
+
+template<typename Op, typename A>
+using unary_expr_t = typename std::enable_if<!expr_node_t<A>::is_scalar,
+	UnaryExpr<Op, expr_node_t<A>>>::type;
+
+template<typename Op, typename L, typename R>
+binary_expr_t<Op, L, R> make_binary_expr(const L &l, const R &r)
+{
+	return binary_expr_t<Op, L, R>(expr_node<L>::make(l), expr_node<R>::make(r));
+}
+
+template<typename Op, typename A>
+unary_expr_t<Op, A> make_unary_expr(const A &a)
+{
+	return unary_expr_t<Op, A>(expr_node<A>::make(a));
+}
+
+template<typename L, typename R>
+binary_expr_t<ExprPlus, L, R> operator + (const L &l, const R &r)
+{
+	return make_binary_expr<ExprPlus>(l, r);
+}
+
+template<typename L, typename R>
+binary_expr_t<ExprMinus, L, R> operator - (const L &l, const R &r)
+{
+	return make_binary_expr<ExprMinus>(l, r);
+}
+
+template<typename L, typename R>
+binary_expr_t<ExprMultiplies, L, R> operator * (const L &l, const R &r)
+{
+	return make_binary_expr<ExprMultiplies>(l, r);
+}
+
+template<typename L, typename R>
+binary_expr_t<ExprDivides, L, R> operator / (const L &l, const R &r)
+{
+	return make_binary_expr<ExprDivides>(l, r);
+}
+
+template<typename L, typename R>
+binary_expr_t<ExprMin, L, R> min(const L &l, const R &r)
+{
+	return make_binary_expr<ExprMin>(l, r);
+}
+
+template<typename L, typename R>
+binary_expr_t<ExprMax, L, R> max(const L &l, const R &r)
+{
+	return make_binary_expr<ExprMax>(l, r);
+}
+
+template<typename A>
+unary_expr_t<ExprNegate, A> operator - (const A &a)
+{
+	return make_unary_expr<ExprNegate>(a);
+}
+
+template<typename A>
+unary_expr_t<ExprSqrt, A> sqrt(const A &a)
+{
+	return make_unary_expr<ExprSqrt>(a);
+}
+
+template<typename A>
+unary_expr_t<ExprAbs, A> abs(const A &a)
+{
+	return make_unary_expr<ExprAbs>(a);
+}
+
+template<typename To, typename A>
+unary_expr_t<ExprCast<To>, A> cast(const A &a)
+{
+	return make_unary_expr<ExprCast<To>>(a);
+}
+
+// Evaluate expression into existing matrix of the same size (it may be a
+// submatrix or a leaf of the expression itself). Values are converted
+// to ValueT as on assignment.
+template<typename ValueT, typename Expr>
+void eval_into(Matrix<ValueT> &dst, const MatrixExpr<Expr> &expr)
+{
+	const Expr &e = expr.derived();
+	static_assert(!Expr::is_scalar, "Expression must contain a matrix");
+	if (dst.n_rows != e.rows() || dst.n_cols != e.cols())
+		throw std::string("Size of destination differs from size of expression");
+	for (uint i = 0; i < dst.n_rows; ++i) {
+		const typename Expr::Row src = e.row(i);
+		ValueT *line = dst.row(i);
+		for (uint j = 0; j < dst.n_cols; ++j)
+			line[j] = static_cast<ValueT>(src[j]);
+	}
+}
+
+template<typename ValueT>
+template<typename Expr>
+Matrix<ValueT>::Matrix(const MatrixExpr<Expr> &expr) :
+	Matrix(expr.derived().rows(), expr.derived().cols())
+{
+	eval_into(*this, expr);
+}
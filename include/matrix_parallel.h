@@ -0,0 +1,77 @@
+#pragma once
+
+// Parallel overloads of Matrix::unary_map. They are kept apart from
+// matrix.h, so that users of Matrix don't depend on thread pool.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+#include "thread_pool.h"
+
+#ifdef DEBUG
+// Tiling must not change result, check parallel map against sequential one
+template<typename ValueT>
+void check_same_map(const Matrix<ValueT> &parallel, const Matrix<ValueT> &sequential)
+{
+	for (uint i = 0; i < parallel.n_rows; ++i)
+		if (!std::equal(parallel.row(i), parallel.row(i) + parallel.n_cols, sequential.row(i)))
+			throw std::string("Parallel unary_map differs from sequential one");
+}
+#endif
+
+template<typename ValueT>
+template<typename UnaryMatrixOperator>
+Matrix<stencil_result_t<const UnaryMatrixOperator, ValueT>>
+	Matrix<ValueT>::unary_map(const UnaryMatrixOperator &op, ThreadPool &pool) const
+{
+	typedef stencil_result_t<const UnaryMatrixOperator, ValueT> ReturnT;
+	if (n_cols * n_rows == 0)
+		return Matrix<ReturnT>(0, 0);
+
+	Matrix<ReturnT> tmp(n_rows, n_cols);
+	const BorderedView<ValueT> view(*this, BorderPolicy::Mirror);
+	pool.parallel_for(tile_count(), [this, &op, &view, &tmp](size_t idx) {
+		uint row_begin, row_end, col_begin, col_end;
+		tile_bounds(idx, &row_begin, &row_end, &col_begin, &col_end);
+		Matrix<ValueT> scratch(2 * op.vert_radius + 1, 2 * op.hor_radius + 1);
+		stencil_tile(op, view, tmp, row_begin, row_end, col_begin, col_end, scratch);
+	});
+#ifdef DEBUG
+	check_same_map(tmp, unary_map(op));
+#endif
+	return tmp;
+}
+
+template<typename ValueT>
+template<typename UnaryMatrixOperator, typename Reduce>
+Matrix<stencil_result_t<UnaryMatrixOperator, ValueT>>
+	Matrix<ValueT>::unary_map(UnaryMatrixOperator &op, ThreadPool &pool, Reduce reduce) const
+{
+	typedef stencil_result_t<UnaryMatrixOperator, ValueT> ReturnT;
+	if (n_cols * n_rows == 0)
+		return Matrix<ReturnT>(0, 0);
+
+	Matrix<ReturnT> tmp(n_rows, n_cols);
+	const BorderedView<ValueT> view(*this, BorderPolicy::Mirror);
+	// copies are made in advance, so workers don't read op while it is merged
+	std::vector<UnaryMatrixOperator> tile_ops(tile_count(), op);
+#ifdef DEBUG
+	UnaryMatrixOperator check_op(op);
+	const Matrix<ReturnT> expected = unary_map(check_op);
+#endif
+	pool.parallel_for(tile_ops.size(), [this, &tile_ops, &view, &tmp](size_t idx) {
+		UnaryMatrixOperator &tile_op = tile_ops[idx];
+		uint row_begin, row_end, col_begin, col_end;
+		tile_bounds(idx, &row_begin, &row_end, &col_begin, &col_end);
+		Matrix<ValueT> scratch(2 * tile_op.vert_radius + 1, 2 * tile_op.hor_radius + 1);
+		stencil_tile(tile_op, view, tmp, row_begin, row_end, col_begin, col_end, scratch);
+	});
+	for (const auto &tile_op : tile_ops)
+		reduce(op, tile_op);
+#ifdef DEBUG
+	check_same_map(tmp, expected);
+#endif
+	return tmp;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct model;
+
+// Dense view of linear model weights, as used by prediction.
+// Weights are class-major: weight of 'feature' for class 'c' is
+// w[c * w_stride + feature], bias weight (if bias >= 0) follows the last
+// feature. Rows are padded so that every row of an aligned block starts
+// on a 64-byte boundary.
+struct TModelWeights {
+    int solver_type;
+    int nr_class;
+        // Number of weight rows: one for two-class models (except MCSVM_CS), nr_class otherwise
+    size_t nr_w;
+    size_t nr_feature;
+    double bias;
+    const int* label;
+    const double* w;
+    size_t w_stride;
+
+    TModelWeights();
+};
+
+// Copy weights of liblinear 'model' to 'storage' in class-major order
+// and describe them in 'weights'. Labels are taken from 'model' in place.
+void TransposeWeights(const struct model* model, std::vector<double>* storage,
+                      TModelWeights* weights);
+
+// Models remember version of feature extractor their descriptors were
+// built with, so that model isn't used with descriptors of other meaning.
+// 0 means unknown version (model was saved by older program).
+//
+// Text models are liblinear files followed by line "extractor_version N",
+// liblinear ignores everything after weights.
+
+// Append extractor version line to text model 'model_file'
+bool AppendExtractorVersion(const std::string& model_file, uint32_t extractor_version);
+
+// Extractor version of text model 'model_file', 0 if it isn't recorded
+uint32_t ReadExtractorVersion(const std::string& model_file);
+
+// Binary model file.
+// Weights can be used in place from mapped memory, no parsing is needed.
+//
+// File format: fixed header (magic "MG2MODEL", uint32 format version,
+// uint32 byte order tag, model parameters, extractor version and offsets),
+// int32 labels, then doubles of weights at 64-byte aligned offset, laid
+// out as in TModelWeights. Files written on machine of other byte order
+// or in other format version are rejected.
+
+// Check whether 'model_file' starts with binary model magic
+bool IsBinaryModelFile(const std::string& model_file);
+
+// Write 'weights' of model built with 'extractor_version' to binary 'model_file'
+bool SaveBinaryModel(const std::string& model_file, const TModelWeights& weights,
+                     uint32_t extractor_version);
+
+// Binary model file mapped to memory.
+class TMappedModel {
+ public:
+        // Map 'model_file', check Valid() for result
+    explicit TMappedModel(const std::string& model_file);
+    ~TMappedModel();
+
+    TMappedModel(const TMappedModel&) = delete;
+    TMappedModel& operator=(const TMappedModel&) = delete;
+
+    bool Valid() const { return data_ != nullptr; }
+        // Weights pointing into mapped file
+    const TModelWeights& Weights() const { return weights_; }
+        // Version of extractor model was trained with
+    uint32_t ExtractorVersion() const { return extractor_version_; }
+
+ private:
+    void* data_;
+    size_t size_;
+    TModelWeights weights_;
+    uint32_t extractor_version_;
+};
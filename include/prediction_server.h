@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "classifier.h"
+#include "decoder.h"
+#include "thread_pool.h"
+
+// Long-running prediction service: model is loaded once and requests
+// are answered as they come.
+//
+// Line protocol, the same for stdin/stdout and Unix socket clients:
+// request "<path>\n"                  image file to classify;
+// request "RAW <width> <height>\n"    followed by width * height * 3 bytes,
+//                                     interleaved R, G, B pixels, top row first;
+// reply   "<label>\n" or "ERROR <reason>\n", one per request, in request order.
+// Clients may send many requests without waiting for replies.
+//
+// Requests of all clients go to one queue. Batching thread takes whatever
+// is queued (up to max_batch requests), decodes images and extracts
+// descriptors on the pool and scores the whole batch at once. Under light
+// load batch has one request and nothing waits for others, under heavy
+// load batches grow and keep all workers busy.
+class TPredictionServer {
+ public:
+        // Compute descriptor of image into 'desc' of 'dim' floats
+    typedef std::function<void(const TImage&, float*)> TExtractor;
+
+    TPredictionServer(const TModel& model, TExtractor extractor, size_t dim,
+                      ThreadPool& pool, size_t max_batch);
+        // Finishes queued requests
+    ~TPredictionServer();
+
+    TPredictionServer(const TPredictionServer&) = delete;
+    TPredictionServer& operator=(const TPredictionServer&) = delete;
+
+        // Answer requests read from 'in_fd' to 'out_fd' until end of input
+    void ServeStream(int in_fd, int out_fd);
+        // Accept clients on Unix socket 'socket_path', each in its own thread.
+        // Returns only if socket can't be set up or accept fails.
+    bool ServeSocket(const std::string& socket_path);
+
+ private:
+    struct TRequest {
+            // Image file or empty for raw pixels
+        std::string path;
+            // Raw pixels, decoded file later
+        std::unique_ptr<TImage> image;
+        std::promise<std::string> reply;
+    };
+
+    void BatchLoop();
+    void ProcessBatch(std::vector<std::unique_ptr<TRequest>>* batch);
+
+    const TModel& model_;
+    TClassifier classifier_;
+    TExtractor extractor_;
+    size_t dim_;
+    ThreadPool& pool_;
+    size_t max_batch_;
+    BoundedQueue<std::unique_ptr<TRequest>> queue_;
+    std::thread batcher_;
+};
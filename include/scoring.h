@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+#include "feature_matrix.h"
+
+// Dense linear scoring of a batch of samples, GEMM-style:
+// dec[s * nr_w + c] += sum_j features.Row(s)[j] * weights[c * w_stride + j], j < n.
+// Weights of every class are contiguous (transposed liblinear layout).
+// Samples are processed in blocks of 4 sharing every weight load and
+// features in chunks which stay in cache while all classes are scored.
+// Vectorized (SSE2/AVX2) kernel is selected at runtime.
+void ScoreDense(const TFeatureMatrix& features, const double* weights, size_t w_stride,
+                size_t nr_w, size_t n, double* dec);
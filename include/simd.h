@@ -0,0 +1,32 @@
+#pragma once
+
+// Helpers for choosing vectorized kernels at runtime.
+// Vectorized code is compiled only on x86; other platforms always get
+// scalar kernels.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// SSE2 is a part of x86-64, on 32-bit x86 it is an extension.
+inline bool cpuHasSse2()
+{
+#ifdef SIMD_X86
+    // init is needed if we are called from static initialization
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+inline bool cpuHasAvx2()
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef unsigned int uint;
+
+// Fixed set of worker threads executing submitted jobs.
+//
+// Example:
+// ThreadPool pool(4);
+// std::vector<int> squares(100);
+// pool.parallel_for(squares.size(), [&](size_t i) { squares[i] = i * i; });
+class ThreadPool
+{
+public:
+	// Start thread_count workers. 0 means one worker per hardware thread.
+	explicit ThreadPool(uint thread_count = 0);
+	// Waits for queued jobs and joins workers.
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator = (const ThreadPool &) = delete;
+
+	// Number of workers
+	uint size() const;
+
+	// Queue job for execution by some worker.
+	void submit(std::function<void()> job);
+
+	// Block until all submitted jobs are finished. If some job has thrown,
+	// the first exception is rethrown here.
+	void wait();
+
+	// Call task(i) for every i in [0, count) and wait for all of them.
+	// Indices are handed out one by one as workers become free, so
+	// uneven tasks are balanced. task must be safe to call concurrently.
+	// Calling thread takes indices too, and only tasks of this call are
+	// waited for, so it may be called from a job of the same pool.
+	// If some task has thrown, the first exception is rethrown here.
+	void parallel_for(size_t count, const std::function<void(size_t)> &task);
+
+private:
+	void worker_loop();
+
+	std::vector<std::thread> workers_;
+	std::deque<std::function<void()>> jobs_;
+	// Jobs which are queued or running
+	size_t pending_;
+	bool stopping_;
+	std::exception_ptr error_;
+	std::mutex mutex_;
+	// Signals workers about new jobs and stop
+	std::condition_variable job_cv_;
+	// Signals wait() that pending_ dropped to zero
+	std::condition_variable done_cv_;
+};
@@ -1,34 +1,14 @@
 #include "Usable.h"
+#include "simd.h"
 #include <assert.h>
+#include <cmath>
+#include <vector>
 
-Matrix<double> grayscale(BMP &img)
+Matrix<double> grayscale(const TImage &img)
 {
-    constexpr double R_COEF = 0.229, G_COEF = 0.587, B_COEF = 0.144;
-    Matrix<double> imgMatrix(static_cast<uint>(img.TellHeight()),
-                              static_cast<uint>(img.TellWidth()));
-    for (uint i = 0; i < imgMatrix.n_rows; ++i) {
-        for (uint j = 0; j < imgMatrix.n_cols; ++j) {
-            RGBApixel *p = img(j, i);
-            imgMatrix(i, j) = R_COEF * p->Red + G_COEF * p->Green + B_COEF * p->Blue;
-        }
-    }
-    return imgMatrix;
-}
-
-Matrix<std::tuple<uint, uint, uint>> origin(BMP &img)
-{
-    Matrix<std::tuple<uint, uint, uint>> imgMatrix(static_cast<uint>(img.TellHeight()),
-                                                   static_cast<uint>(img.TellWidth()));
-    for (uint i = 0; i < imgMatrix.n_rows; ++i) {
-        for (uint j = 0; j < imgMatrix.n_cols; ++j) {
-            RGBApixel *p = img(j, i);
-            imgMatrix(i, j) = std::make_tuple(p->Red, p->Green, p->Blue);
-        }
-    }
-    return imgMatrix;
+    return zip_map([](uint8_t value) { return static_cast<double>(value); }, img.gray);
 }
 
-
 Matrix<double> sobel_x(const Matrix<double> &src_image) {
     Matrix<double> kernel = {{-1, 0, 1},
                              {-2, 0, 2},
@@ -42,3 +22,337 @@ Matrix<double> sobel_y(const Matrix<double> &src_image) {
                              {-1, -2, -1}};
     return custom(src_image, kernel);
 }
+
+namespace {
+
+/// Sobel projections and absolute values of one row of n pixels.
+/// up, mid and down are rows of mirrored image around the row, so pixel j
+/// has neighbours in columns j, j + 1 and j + 2.
+/// Kernels are separable: [1 2 1] smoothing and [-1 0 1] difference.
+typedef void (*SobelRowFn)(const double *up, const double *mid, const double *down, uint n,
+                           double *gx, double *gy, double *abs);
+
+void sobelRowScalar(const double *up, const double *mid, const double *down, uint n,
+                    double *gx, double *gy, double *abs)
+{
+    for (uint j = 0; j < n; j++) {
+        double s0 = up[j] + 2 * mid[j] + down[j];
+        double s2 = up[j + 2] + 2 * mid[j + 2] + down[j + 2];
+        double d0 = up[j] - down[j];
+        double d1 = up[j + 1] - down[j + 1];
+        double d2 = up[j + 2] - down[j + 2];
+        gx[j] = s2 - s0;
+        gy[j] = d0 + 2 * d1 + d2;
+        abs[j] = std::sqrt(gx[j] * gx[j] + gy[j] * gy[j]);
+    }
+}
+
+#ifdef SIMD_X86
+// Vector kernels do the same operations in the same order as the scalar
+// one, so results are bit-identical.
+
+__attribute__((target("sse2")))
+void sobelRowSse2(const double *up, const double *mid, const double *down, uint n,
+                  double *gx, double *gy, double *abs)
+{
+    const __m128d two = _mm_set1_pd(2);
+    uint j = 0;
+    for (; j + 2 <= n; j += 2) {
+        __m128d u0 = _mm_loadu_pd(up + j), u1 = _mm_loadu_pd(up + j + 1), u2 = _mm_loadu_pd(up + j + 2);
+        __m128d m0 = _mm_loadu_pd(mid + j), m2 = _mm_loadu_pd(mid + j + 2);
+        __m128d b0 = _mm_loadu_pd(down + j), b1 = _mm_loadu_pd(down + j + 1), b2 = _mm_loadu_pd(down + j + 2);
+        __m128d s0 = _mm_add_pd(_mm_add_pd(u0, _mm_mul_pd(two, m0)), b0);
+        __m128d s2 = _mm_add_pd(_mm_add_pd(u2, _mm_mul_pd(two, m2)), b2);
+        __m128d x = _mm_sub_pd(s2, s0);
+        __m128d y = _mm_add_pd(_mm_add_pd(_mm_sub_pd(u0, b0), _mm_mul_pd(two, _mm_sub_pd(u1, b1))),
+                               _mm_sub_pd(u2, b2));
+        _mm_storeu_pd(gx + j, x);
+        _mm_storeu_pd(gy + j, y);
+        _mm_storeu_pd(abs + j, _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y))));
+    }
+    sobelRowScalar(up + j, mid + j, down + j, n - j, gx + j, gy + j, abs + j);
+}
+
+__attribute__((target("avx2")))
+void sobelRowAvx2(const double *up, const double *mid, const double *down, uint n,
+                  double *gx, double *gy, double *abs)
+{
+    const __m256d two = _mm256_set1_pd(2);
+    uint j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m256d u0 = _mm256_loadu_pd(up + j), u1 = _mm256_loadu_pd(up + j + 1), u2 = _mm256_loadu_pd(up + j + 2);
+        __m256d m0 = _mm256_loadu_pd(mid + j), m2 = _mm256_loadu_pd(mid + j + 2);
+        __m256d b0 = _mm256_loadu_pd(down + j), b1 = _mm256_loadu_pd(down + j + 1), b2 = _mm256_loadu_pd(down + j + 2);
+        __m256d s0 = _mm256_add_pd(_mm256_add_pd(u0, _mm256_mul_pd(two, m0)), b0);
+        __m256d s2 = _mm256_add_pd(_mm256_add_pd(u2, _mm256_mul_pd(two, m2)), b2);
+        __m256d x = _mm256_sub_pd(s2, s0);
+        __m256d y = _mm256_add_pd(_mm256_add_pd(_mm256_sub_pd(u0, b0), _mm256_mul_pd(two, _mm256_sub_pd(u1, b1))),
+                                  _mm256_sub_pd(u2, b2));
+        _mm256_storeu_pd(gx + j, x);
+        _mm256_storeu_pd(gy + j, y);
+        _mm256_storeu_pd(abs + j, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y))));
+    }
+    sobelRowScalar(up + j, mid + j, down + j, n - j, gx + j, gy + j, abs + j);
+}
+#endif
+
+SobelRowFn selectSobelRow()
+{
+#ifdef SIMD_X86
+    if (cpuHasAvx2())
+        return sobelRowAvx2;
+    if (cpuHasSse2())
+        return sobelRowSse2;
+#endif
+    return sobelRowScalar;
+}
+
+}
+
+namespace {
+
+/// Orientation sectors of gradients: sector k is [-pi + 2 pi k / n, -pi + 2 pi (k + 1) / n),
+/// as (pi + atan2(y, x)) * n / 2 / pi rounded down.
+/// Direction rotated by pi falls into the upper half-plane [0, pi) of the
+/// first n / 2 sectors, the opposite one into the rest; within a half
+/// sector is the number of boundaries the direction has passed, i.e. of
+/// nonnegative cross products with boundary directions. So direction lying
+/// on a boundary belongs to the sector above it, as in the atan2 formula.
+class OrientationSectors
+{
+public:
+    explicit OrientationSectors(uint nBins) : nBins_(nBins), dx_(nBins / 2 + 1), dy_(nBins / 2 + 1)
+    {
+        assert(nBins % 2 == 0 && nBins > 0);
+        // boundaries at multiples of pi / 4 are exact: integer gradients
+        // often lie on axes and diagonals, and their bins mustn't depend on
+        // last bits of cos and sin of libm
+        static const double exactX[] = {1, M_SQRT1_2, 0, -M_SQRT1_2, -1};
+        static const double exactY[] = {0, M_SQRT1_2, 1, M_SQRT1_2, 0};
+        for (uint k = 0; k <= nBins / 2; k++) {
+            if (8 * k % nBins == 0) {
+                dx_[k] = exactX[8 * k / nBins];
+                dy_[k] = exactY[8 * k / nBins];
+            } else {
+                double angle = 2 * M_PI * k / nBins;
+                dx_[k] = std::cos(angle);
+                dy_[k] = std::sin(angle);
+            }
+        }
+    }
+
+    uint hard(double x, double y) const
+    {
+        double ux, uy;
+        uint base = half(x, y, &ux, &uy);
+        return base + countPassed(ux, uy);
+    }
+
+    /// bin of lower of two nearest bin centers, share of the upper one goes to 'share'
+    uint soft(double x, double y, double *share) const
+    {
+        double ux, uy;
+        uint base = half(x, y, &ux, &uy);
+        uint k = countPassed(ux, uy);
+        // position in sector: ratio of distances to its boundaries, it is
+        // not linear in angle (for 8 bins differs from ratio of angles by up
+        // to about 0.01, less for more bins)
+        double lo = dx_[k] * uy - dy_[k] * ux;
+        double hi = ux * dy_[k + 1] - uy * dx_[k + 1];
+        double t = lo + hi > 0 ? lo / (lo + hi) : 0;
+        uint bin = base + k;
+        if (t < 0.5) {
+            *share = 0.5 + t;
+            return (bin + nBins_ - 1) % nBins_;
+        }
+        *share = t - 0.5;
+        return bin;
+    }
+
+private:
+    /// first sector of half-plane of direction (x, y), direction turned into upper half-plane
+    uint half(double x, double y, double *ux, double *uy) const
+    {
+        // rotated by pi direction (-x, -y) is in [0, pi): -y > 0 or -y == 0 and -x > 0
+        bool upper = y < 0 || (!(y > 0) && x < 0);
+        *ux = upper ? -x : x;
+        *uy = upper ? -y : y;
+        return upper ? 0 : nBins_ / 2;
+    }
+
+    uint countPassed(double ux, double uy) const
+    {
+        uint count = 0;
+        for (uint k = 1; k < nBins_ / 2; k++)
+            count += dx_[k] * uy - dy_[k] * ux >= 0;
+        return count;
+    }
+
+    uint nBins_;
+    /// directions of boundaries in [0, pi]
+    std::vector<double> dx_, dy_;
+};
+
+#ifdef DEBUG
+/// Sobel gradients of 8-bit images are integers in [-1020, 1020], check that
+/// all of them (except zero one, which has no direction) get the same bins
+/// as from the atan2 formula
+bool sectorsMatchAtan2(const OrientationSectors &sectors, uint nBins)
+{
+    const int limit = 4 * 255;
+    for (int y = -limit; y <= limit; y++) {
+        for (int x = -limit; x <= limit; x++) {
+            if (x == 0 && y == 0)
+                continue;
+            double tmpIdx = (M_PI + std::atan2(y, x)) * nBins / 2 / M_PI;
+            if (sectors.hard(x, y) != uint(tmpIdx) % nBins)
+                return false;
+        }
+    }
+    return true;
+}
+#endif
+
+}
+
+Gradient sobelGradient(const BorderedView<double> &src_image, uint nBins, OrientationBinning binning)
+{
+    static const SobelRowFn sobelRow = selectSobelRow();
+
+    const uint n = src_image.n_rows, m = src_image.n_cols;
+    const bool soft = binning == OrientationBinning::Soft;
+    Gradient ans{Matrix<double>(n, m), Matrix<double>(n, m), Matrix<double>(n, m), Matrix<uint8_t>(n, m),
+                 soft ? Matrix<double>(n, m) : Matrix<double>(0, 0)};
+    if (n * m == 0)
+        return ans;
+
+    const OrientationSectors sectors(nBins);
+#ifdef DEBUG
+    // once per process, for nBins of the first call
+    static const bool sectorsChecked = sectorsMatchAtan2(sectors, nBins);
+    assert(sectorsChecked);
+#endif
+    for_each_stencil_row(src_image, 1, 1, [&](const double *const *rows, uint i, uint j0, uint count) {
+        double *xLine = ans.x.row(i) + j0, *yLine = ans.y.row(i) + j0, *absLine = ans.abs.row(i) + j0;
+        sobelRow(rows[0], rows[1], rows[2], count, xLine, yLine, absLine);
+        // row is still in cache: orientation bins
+        uint8_t *binLine = ans.bin.row(i) + j0;
+        if (soft) {
+            double *shareLine = ans.share.row(i) + j0;
+            for (uint j = 0; j < count; j++)
+                binLine[j] = static_cast<uint8_t>(sectors.soft(xLine[j], yLine[j], shareLine + j));
+        } else {
+            for (uint j = 0; j < count; j++)
+                binLine[j] = static_cast<uint8_t>(sectors.hard(xLine[j], yLine[j]));
+        }
+    });
+    return ans;
+}
+
+Gradient sobelGradient(const Matrix<double> &src_image, uint nBins, OrientationBinning binning)
+{
+    return sobelGradient(BorderedView<double>(src_image, BorderPolicy::Mirror), nBins, binning);
+}
+
+namespace {
+
+/// LBP codes of one row of n pixels; up, mid and down are rows of mirrored
+/// image around the row, as in SobelRowFn.
+typedef void (*LbpRowFn)(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint n,
+                         uint8_t *codes);
+
+void lbpRowScalar(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint n,
+                  uint8_t *codes)
+{
+    for (uint j = 0; j < n; j++) {
+        const uint8_t center = mid[j + 1];
+        codes[j] = static_cast<uint8_t>((center <= up[j]) << 7 | (center <= up[j + 1]) << 6 |
+                                        (center <= up[j + 2]) << 5 | (center <= mid[j]) << 4 |
+                                        (center <= mid[j + 2]) << 3 | (center <= down[j]) << 2 |
+                                        (center <= down[j + 1]) << 1 | (center <= down[j + 2]));
+    }
+}
+
+#ifdef SIMD_X86
+// Unsigned center <= neighbour is max(center, neighbour) == neighbour;
+// the all-ones byte of comparison is masked to the neighbour's bit.
+
+__attribute__((target("sse2")))
+inline __m128i lbpBitSse2(__m128i center, const uint8_t *neighbour, uint8_t bit)
+{
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(neighbour));
+    __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(center, v), v);
+    return _mm_and_si128(ge, _mm_set1_epi8(static_cast<char>(bit)));
+}
+
+__attribute__((target("sse2")))
+void lbpRowSse2(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint n,
+                uint8_t *codes)
+{
+    uint j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mid + j + 1));
+        __m128i code = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(lbpBitSse2(c, up + j, 0x80), lbpBitSse2(c, up + j + 1, 0x40)),
+                         _mm_or_si128(lbpBitSse2(c, up + j + 2, 0x20), lbpBitSse2(c, mid + j, 0x10))),
+            _mm_or_si128(_mm_or_si128(lbpBitSse2(c, mid + j + 2, 0x08), lbpBitSse2(c, down + j, 0x04)),
+                         _mm_or_si128(lbpBitSse2(c, down + j + 1, 0x02), lbpBitSse2(c, down + j + 2, 0x01))));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(codes + j), code);
+    }
+    lbpRowScalar(up + j, mid + j, down + j, n - j, codes + j);
+}
+
+__attribute__((target("avx2")))
+inline __m256i lbpBitAvx2(__m256i center, const uint8_t *neighbour, uint8_t bit)
+{
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(neighbour));
+    __m256i ge = _mm256_cmpeq_epi8(_mm256_max_epu8(center, v), v);
+    return _mm256_and_si256(ge, _mm256_set1_epi8(static_cast<char>(bit)));
+}
+
+__attribute__((target("avx2")))
+void lbpRowAvx2(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint n,
+                uint8_t *codes)
+{
+    uint j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mid + j + 1));
+        __m256i code = _mm256_or_si256(
+            _mm256_or_si256(_mm256_or_si256(lbpBitAvx2(c, up + j, 0x80), lbpBitAvx2(c, up + j + 1, 0x40)),
+                            _mm256_or_si256(lbpBitAvx2(c, up + j + 2, 0x20), lbpBitAvx2(c, mid + j, 0x10))),
+            _mm256_or_si256(_mm256_or_si256(lbpBitAvx2(c, mid + j + 2, 0x08), lbpBitAvx2(c, down + j, 0x04)),
+                            _mm256_or_si256(lbpBitAvx2(c, down + j + 1, 0x02), lbpBitAvx2(c, down + j + 2, 0x01))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(codes + j), code);
+    }
+    lbpRowSse2(up + j, mid + j, down + j, n - j, codes + j);
+}
+#endif
+
+LbpRowFn selectLbpRow()
+{
+#ifdef SIMD_X86
+    if (cpuHasAvx2())
+        return lbpRowAvx2;
+    if (cpuHasSse2())
+        return lbpRowSse2;
+#endif
+    return lbpRowScalar;
+}
+
+}
+
+Matrix<uint8_t> lbpCodes(const BorderedView<uint8_t> &src_image)
+{
+    static const LbpRowFn lbpRow = selectLbpRow();
+
+    Matrix<uint8_t> ans(src_image.n_rows, src_image.n_cols);
+    for_each_stencil_row(src_image, 1, 1, [&ans](const uint8_t *const *rows, uint i, uint j0, uint count) {
+        lbpRow(rows[0], rows[1], rows[2], count, ans.row(i) + j0);
+    });
+    return ans;
+}
+
+Matrix<uint8_t> lbpCodes(const Matrix<uint8_t> &src_image)
+{
+    return lbpCodes(BorderedView<uint8_t>(src_image, BorderPolicy::Mirror));
+}
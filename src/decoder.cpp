@@ -0,0 +1,201 @@
+#include "decoder.h"
+#include "simd.h"
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+// BMP headers are little-endian regardless of platform
+uint32_t readLe32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint16_t readLe16(const uint8_t *p)
+{
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+/// Grayscale of one row of n pixels from its color planes.
+typedef void (*GrayRowFn)(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint n, uint8_t *gray);
+
+void grayRowScalar(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint n, uint8_t *gray)
+{
+    for (uint j = 0; j < n; ++j) {
+        gray[j] = static_cast<uint8_t>((r[j] * GRAY_R_WEIGHT + g[j] * GRAY_G_WEIGHT + b[j] * GRAY_B_WEIGHT + 128) >> 8);
+    }
+}
+
+#ifdef SIMD_X86
+// Weighted sum fits 16 bits, so vector kernels compute it exactly in
+// 16-bit lanes and results are identical to the scalar kernel.
+
+__attribute__((target("sse2")))
+void grayRowSse2(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint n, uint8_t *gray)
+{
+    const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi16(128);
+    const __m128i wr = _mm_set1_epi16(GRAY_R_WEIGHT), wg = _mm_set1_epi16(GRAY_G_WEIGHT),
+                  wb = _mm_set1_epi16(GRAY_B_WEIGHT);
+    uint j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m128i vr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + j));
+        __m128i vg = _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + j));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + j));
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(vr, zero), wr),
+                                                 _mm_mullo_epi16(_mm_unpacklo_epi8(vg, zero), wg)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb), half));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(vr, zero), wr),
+                                                 _mm_mullo_epi16(_mm_unpackhi_epi8(vg, zero), wg)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb), half));
+        __m128i res = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(gray + j), res);
+    }
+    grayRowScalar(r + j, g + j, b + j, n - j, gray + j);
+}
+
+__attribute__((target("avx2")))
+void grayRowAvx2(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint n, uint8_t *gray)
+{
+    const __m256i half = _mm256_set1_epi16(128);
+    const __m256i wr = _mm256_set1_epi16(GRAY_R_WEIGHT), wg = _mm256_set1_epi16(GRAY_G_WEIGHT),
+                  wb = _mm256_set1_epi16(GRAY_B_WEIGHT);
+    uint j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m256i vr = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(r + j)));
+        __m256i vg = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(g + j)));
+        __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + j)));
+        __m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(vr, wr), _mm256_mullo_epi16(vg, wg)),
+                                       _mm256_add_epi16(_mm256_mullo_epi16(vb, wb), half));
+        sum = _mm256_srli_epi16(sum, 8);
+        // pack 16 words into 16 bytes: lanes of packus are 128-bit
+        __m128i res = _mm_packus_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(gray + j), res);
+    }
+    grayRowScalar(r + j, g + j, b + j, n - j, gray + j);
+}
+#endif
+
+GrayRowFn selectGrayRow()
+{
+#ifdef SIMD_X86
+    if (cpuHasAvx2())
+        return grayRowAvx2;
+    if (cpuHasSse2())
+        return grayRowSse2;
+#endif
+    return grayRowScalar;
+}
+
+const GrayRowFn grayRow = selectGrayRow();
+
+TImage allocateImage(uint nRows, uint nCols)
+{
+    return TImage{Image<uint8_t, 3>(nRows, nCols), Matrix<uint8_t>(nRows, nCols)};
+}
+
+constexpr size_t FILE_HEADER_SZ = 14;
+constexpr size_t INFO_HEADER_SZ = 40;
+constexpr uint32_t BI_RGB = 0;
+
+/// Fast path: uncompressed 24/32-bit BMP. Returns false if buffer has any other format
+/// (or is broken), then caller should fall back to EasyBMP.
+bool decodeTrueColor(const std::vector<uint8_t> &buffer, TImage *image)
+{
+    if (buffer.size() < FILE_HEADER_SZ + INFO_HEADER_SZ || buffer[0] != 'B' || buffer[1] != 'M')
+        return false;
+    const uint8_t *info = buffer.data() + FILE_HEADER_SZ;
+    const uint32_t offset = readLe32(buffer.data() + 10);
+    const int32_t width = static_cast<int32_t>(readLe32(info + 4));
+    const int32_t height = static_cast<int32_t>(readLe32(info + 8));
+    const uint16_t bitCount = readLe16(info + 14);
+    const uint32_t compression = readLe32(info + 16);
+    if (readLe32(info) < INFO_HEADER_SZ || compression != BI_RGB || (bitCount != 24 && bitCount != 32))
+        return false;
+    // top-down files (negative height) are not supported by EasyBMP either
+    if (width <= 0 || height <= 0)
+        return false;
+
+    const uint nRows = static_cast<uint>(height), nCols = static_cast<uint>(width);
+    const size_t bytesPerPixel = bitCount / 8;
+    const size_t rowSz = (nCols * bytesPerPixel + 3) / 4 * 4;
+    if (offset > buffer.size() || (buffer.size() - offset) / rowSz < nRows)
+        return false;
+
+    TImage ans = allocateImage(nRows, nCols);
+    for (uint i = 0; i < nRows; ++i) {
+        // rows are stored bottom-up
+        const uint8_t *src = buffer.data() + offset + (nRows - 1 - i) * rowSz;
+        uint8_t *r = ans.rgb.row(RED_CHANNEL, i), *g = ans.rgb.row(GREEN_CHANNEL, i), *b = ans.rgb.row(BLUE_CHANNEL, i);
+        for (uint j = 0; j < nCols; ++j, src += bytesPerPixel) {
+            b[j] = src[0];
+            g[j] = src[1];
+            r[j] = src[2];
+        }
+        // row is still in cache
+        grayRow(r, g, b, nCols, ans.gray.row(i));
+    }
+    *image = ans;
+    return true;
+}
+
+}
+
+bool ReadFileBytes(const std::string &file_name, std::vector<uint8_t> *buffer)
+{
+    std::ifstream stream(file_name.c_str(), std::ios::binary);
+    if (!stream)
+        return false;
+    buffer->assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    return true;
+}
+
+bool DecodeBmp(const std::string &file_name, TImage *image)
+{
+    std::vector<uint8_t> buffer;
+    ReadFileBytes(file_name, &buffer);
+    return DecodeBmp(buffer, file_name, image);
+}
+
+bool DecodeBmp(const std::vector<uint8_t> &buffer, const std::string &file_name, TImage *image)
+{
+    if (decodeTrueColor(buffer, image))
+        return true;
+    BMP img;
+    bool ok = img.ReadFromFile(file_name.c_str());
+    *image = ImageFromBmp(img);
+    return ok;
+}
+
+TImage ImageFromBmp(BMP &img)
+{
+    const uint nRows = static_cast<uint>(img.TellHeight()), nCols = static_cast<uint>(img.TellWidth());
+    TImage ans = allocateImage(nRows, nCols);
+    for (uint i = 0; i < nRows; ++i) {
+        uint8_t *r = ans.rgb.row(RED_CHANNEL, i), *g = ans.rgb.row(GREEN_CHANNEL, i), *b = ans.rgb.row(BLUE_CHANNEL, i);
+        for (uint j = 0; j < nCols; ++j) {
+            RGBApixel *p = img(j, i);
+            r[j] = p->Red;
+            g[j] = p->Green;
+            b[j] = p->Blue;
+        }
+        grayRow(r, g, b, nCols, ans.gray.row(i));
+    }
+    return ans;
+}
+
+TImage ImageFromRgb(const uint8_t *rgb, uint nRows, uint nCols)
+{
+    TImage ans = allocateImage(nRows, nCols);
+    for (uint i = 0; i < nRows; ++i) {
+        uint8_t *r = ans.rgb.row(RED_CHANNEL, i), *g = ans.rgb.row(GREEN_CHANNEL, i), *b = ans.rgb.row(BLUE_CHANNEL, i);
+        for (uint j = 0; j < nCols; ++j, rgb += 3) {
+            r[j] = rgb[0];
+            g[j] = rgb[1];
+            b[j] = rgb[2];
+        }
+        grayRow(r, g, b, nCols, ans.gray.row(i));
+    }
+    return ans;
+}
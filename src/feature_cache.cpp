@@ -0,0 +1,123 @@
+#include "feature_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const char MAGIC[8] = {'M', 'G', '2', 'F', 'E', 'A', 'T', 'C'};
+constexpr uint32_t FORMAT_VERSION = 1;
+
+template <typename T>
+bool readValue(std::istream &stream, T *value)
+{
+    return static_cast<bool>(stream.read(reinterpret_cast<char *>(value), sizeof(T)));
+}
+
+template <typename T>
+void writeValue(std::ostream &stream, const T &value)
+{
+    stream.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+}
+
+uint64_t HashBytes(const uint8_t *data, size_t size, uint64_t seed)
+{
+    constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+TFeatureCache::TFeatureCache(const std::string& cache_file, uint64_t config_key) :
+    cache_file_(cache_file),
+    config_key_(config_key),
+    entries_(),
+    modified_(false),
+    mutex_()
+{
+    std::ifstream stream(cache_file_.c_str(), std::ios::binary);
+    if (!stream)
+        return;
+
+    char magic[sizeof(MAGIC)];
+    uint32_t version = 0;
+    uint64_t key = 0, count = 0;
+    if (!stream.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !readValue(stream, &version) || version != FORMAT_VERSION ||
+        !readValue(stream, &key) || !readValue(stream, &count)) {
+        std::cerr << "Warning! " << cache_file_ << " is not a feature cache, it will be overwritten" << std::endl;
+        return;
+    }
+    if (key != config_key_) {
+            // descriptors were built by other extractor, they are useless
+        return;
+    }
+
+    for (uint64_t entry_idx = 0; entry_idx < count; ++entry_idx) {
+        uint64_t hash = 0;
+        uint32_t dim = 0;
+        if (!readValue(stream, &hash) || !readValue(stream, &dim))
+            break;
+        std::vector<float> desc(dim);
+        if (!stream.read(reinterpret_cast<char *>(desc.data()), dim * sizeof(float)))
+            break;
+        entries_[hash] = std::move(desc);
+    }
+    if (entries_.size() != count) {
+        std::cerr << "Warning! " << cache_file_ << " is truncated" << std::endl;
+        modified_ = true;
+    }
+}
+
+bool TFeatureCache::Lookup(uint64_t content_hash, float* desc, size_t dim) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(content_hash);
+    if (it == entries_.end() || it->second.size() != dim)
+        return false;
+    std::copy(it->second.begin(), it->second.end(), desc);
+    return true;
+}
+
+void TFeatureCache::Insert(uint64_t content_hash, const float* desc, size_t dim)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[content_hash].assign(desc, desc + dim);
+    modified_ = true;
+}
+
+void TFeatureCache::Save() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!modified_)
+        return;
+        // write to temporary file first, so broken run doesn't spoil the cache
+    std::string tmp_file = cache_file_ + ".tmp";
+    {
+        std::ofstream stream(tmp_file.c_str(), std::ios::binary | std::ios::trunc);
+        stream.write(MAGIC, sizeof(MAGIC));
+        writeValue(stream, FORMAT_VERSION);
+        writeValue(stream, config_key_);
+        writeValue(stream, static_cast<uint64_t>(entries_.size()));
+        for (const auto &entry : entries_) {
+            writeValue(stream, entry.first);
+            writeValue(stream, static_cast<uint32_t>(entry.second.size()));
+            stream.write(reinterpret_cast<const char *>(entry.second.data()),
+                         entry.second.size() * sizeof(float));
+        }
+        if (!stream) {
+            std::cerr << "Warning! Can't write feature cache " << tmp_file << std::endl;
+            return;
+        }
+    }
+    if (std::rename(tmp_file.c_str(), cache_file_.c_str()) != 0)
+        std::cerr << "Warning! Can't write feature cache " << cache_file_ << std::endl;
+}
@@ -0,0 +1,92 @@
+#include "image_context.h"
+
+#include <cassert>
+
+namespace {
+
+uint padToMultiple(uint size, uint multiple)
+{
+    return size + (size % multiple ? multiple - size % multiple : 0);
+}
+
+}
+
+TImageContext::TImageContext(const TImage& image, uint cells_per_line, uint orientation_bins,
+                             OrientationBinning binning) :
+    image_(image),
+    orientation_bins_(orientation_bins),
+    binning_(binning),
+    grid_(),
+    gray_double_(),
+    gradients_(),
+    orientation_integrals_(),
+    lbp_codes_(),
+    color_integrals_()
+{
+    assert(cells_per_line > 0);
+    grid_.n_rows = padToMultiple(image.rgb.n_rows, cells_per_line);
+    grid_.n_cols = padToMultiple(image.rgb.n_cols, cells_per_line);
+    grid_.cells_per_line = cells_per_line;
+    grid_.cell_rows = grid_.n_rows / cells_per_line;
+    grid_.cell_cols = grid_.n_cols / cells_per_line;
+}
+
+const Matrix<double>& TImageContext::GrayDouble()
+{
+    if (!gray_double_)
+        gray_double_.reset(new Matrix<double>(grayscale(image_)));
+    return *gray_double_;
+}
+
+const Gradient& TImageContext::Gradients()
+{
+    if (!gradients_) {
+        BorderedView<double> view(GrayDouble(), grid_.n_rows, grid_.n_cols, BorderPolicy::Mirror);
+        gradients_.reset(new Gradient(sobelGradient(view, orientation_bins_, binning_)));
+    }
+    return *gradients_;
+}
+
+const IntegralImage<double>& TImageContext::OrientationIntegrals()
+{
+    if (orientation_integrals_)
+        return *orientation_integrals_;
+
+    const Gradient& gradient = Gradients();
+    const bool soft = gradient.share.n_rows != 0;
+    const uint nBins = orientation_bins_;
+    orientation_integrals_.reset(new IntegralImage<double>(
+        gradient.abs.n_rows, gradient.abs.n_cols, nBins,
+        [&gradient, soft, nBins](uint i, double *values) {
+            const double *absLine = gradient.abs.row(i);
+            const uint8_t *binsLine = gradient.bin.row(i);
+            if (!soft) {
+                for (uint j = 0; j < gradient.abs.n_cols; j++) {
+                    values[j * nBins + binsLine[j]] += absLine[j];
+                }
+                return;
+            }
+            // soft binning splits magnitude between two bins
+            const double *shareLine = gradient.share.row(i);
+            for (uint j = 0; j < gradient.abs.n_cols; j++) {
+                values[j * nBins + binsLine[j]] += absLine[j] * (1 - shareLine[j]);
+                values[j * nBins + (binsLine[j] + 1) % nBins] += absLine[j] * shareLine[j];
+            }
+        }));
+    return *orientation_integrals_;
+}
+
+const Matrix<uint8_t>& TImageContext::LbpCodes()
+{
+    if (!lbp_codes_)
+        lbp_codes_.reset(new Matrix<uint8_t>(lbpCodes(
+            BorderedView<uint8_t>(image_.gray, grid_.n_rows, grid_.n_cols, BorderPolicy::Mirror))));
+    return *lbp_codes_;
+}
+
+const IntegralImage<uint64_t>& TImageContext::ColorIntegrals()
+{
+    if (!color_integrals_)
+        color_integrals_.reset(new IntegralImage<uint64_t>(image_.rgb));
+    return *color_integrals_;
+}
@@ -0,0 +1,240 @@
+#include "model_file.h"
+#include "linear.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char MAGIC[8] = {'M', 'G', '2', 'M', 'O', 'D', 'E', 'L'};
+constexpr uint32_t FORMAT_VERSION = 2;
+constexpr uint32_t BYTE_ORDER_TAG = 0x01020304;
+constexpr size_t ALIGNMENT = 64;
+
+struct TModelFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t solver_type;
+    int32_t nr_class;
+    uint64_t nr_feature;
+    uint64_t nr_w;
+    uint64_t w_stride;
+    double bias;
+    uint32_t extractor_version;
+    uint32_t reserved;
+    uint64_t labels_offset;
+    uint64_t weights_offset;
+};
+static_assert(sizeof(TModelFileHeader) == 80, "model file header must have no padding");
+
+const char EXTRACTOR_VERSION_KEY[] = "extractor_version";
+
+size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/// Number of weights in one row: features and bias weight
+size_t rowSize(const TModelWeights& weights)
+{
+    return weights.nr_feature + (weights.bias >= 0 ? 1 : 0);
+}
+
+}
+
+TModelWeights::TModelWeights() :
+    solver_type(0),
+    nr_class(0),
+    nr_w(0),
+    nr_feature(0),
+    bias(-1),
+    label(nullptr),
+    w(nullptr),
+    w_stride(0)
+{}
+
+void TransposeWeights(const struct model* model, std::vector<double>* storage,
+                      TModelWeights* weights)
+{
+    weights->solver_type = model->param.solver_type;
+    weights->nr_class = model->nr_class;
+        // two-class models keep one weight column, except Crammer-Singer
+    weights->nr_w = (model->nr_class == 2 && model->param.solver_type != MCSVM_CS) ? 1 : model->nr_class;
+    weights->nr_feature = model->nr_feature;
+    weights->bias = model->bias;
+    weights->label = model->label;
+    weights->w_stride = alignUp(rowSize(*weights), ALIGNMENT / sizeof(double));
+
+        // liblinear stores weights feature-major, w[feature * nr_w + class]
+    size_t nr_w = weights->nr_w;
+    size_t row_size = rowSize(*weights);
+    storage->assign(nr_w * weights->w_stride, 0);
+    for (size_t feature_idx = 0; feature_idx < row_size; ++feature_idx)
+        for (size_t class_idx = 0; class_idx < nr_w; ++class_idx)
+            (*storage)[class_idx * weights->w_stride + feature_idx] = model->w[feature_idx * nr_w + class_idx];
+    weights->w = storage->data();
+}
+
+bool AppendExtractorVersion(const std::string& model_file, uint32_t extractor_version)
+{
+    std::ofstream stream(model_file.c_str(), std::ios::app);
+    stream << EXTRACTOR_VERSION_KEY << " " << extractor_version << "\n";
+    if (!stream) {
+        std::cerr << "Error! Can't write model " << model_file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+uint32_t ReadExtractorVersion(const std::string& model_file)
+{
+        // the line is the last one, weights before it needn't be read
+    std::ifstream stream(model_file.c_str(), std::ios::binary | std::ios::ate);
+    if (!stream)
+        return 0;
+    std::streamoff size = stream.tellg();
+    std::streamoff tail_size = std::min<std::streamoff>(size, 64);
+    std::string tail(static_cast<size_t>(tail_size), '\0');
+    stream.seekg(size - tail_size);
+    if (!stream.read(&tail[0], tail_size))
+        return 0;
+    size_t pos = tail.rfind(std::string("\n") + EXTRACTOR_VERSION_KEY + " ");
+    if (pos == std::string::npos)
+        return 0;
+    unsigned long version = std::strtoul(tail.c_str() + pos + sizeof(EXTRACTOR_VERSION_KEY) + 1, nullptr, 10);
+    return static_cast<uint32_t>(version);
+}
+
+bool IsBinaryModelFile(const std::string& model_file)
+{
+    std::ifstream stream(model_file.c_str(), std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    return stream.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+bool SaveBinaryModel(const std::string& model_file, const TModelWeights& weights,
+                     uint32_t extractor_version)
+{
+    TModelFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.byte_order = BYTE_ORDER_TAG;
+    header.solver_type = weights.solver_type;
+    header.nr_class = weights.nr_class;
+    header.nr_feature = weights.nr_feature;
+    header.nr_w = weights.nr_w;
+    header.w_stride = alignUp(rowSize(weights), ALIGNMENT / sizeof(double));
+    header.bias = weights.bias;
+    header.extractor_version = extractor_version;
+    header.labels_offset = sizeof(header);
+    header.weights_offset = alignUp(header.labels_offset + weights.nr_class * sizeof(int32_t), ALIGNMENT);
+
+        // write to temporary file first, so broken run doesn't spoil the model
+    std::string tmp_file = model_file + ".tmp";
+    {
+        std::ofstream stream(tmp_file.c_str(), std::ios::binary | std::ios::trunc);
+        stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            // regression models have no labels, zeros are written for them
+        for (int class_idx = 0; class_idx < weights.nr_class; ++class_idx) {
+            int32_t label = weights.label ? weights.label[class_idx] : 0;
+            stream.write(reinterpret_cast<const char *>(&label), sizeof(label));
+        }
+        const std::vector<char> padding(ALIGNMENT, 0);
+        stream.write(padding.data(), header.weights_offset - header.labels_offset -
+                                     weights.nr_class * sizeof(int32_t));
+            // rows are written with padding of destination stride
+        std::vector<double> row(header.w_stride, 0);
+        for (size_t class_idx = 0; class_idx < weights.nr_w; ++class_idx) {
+            const double* src = weights.w + class_idx * weights.w_stride;
+            std::copy(src, src + rowSize(weights), row.begin());
+            stream.write(reinterpret_cast<const char *>(row.data()), row.size() * sizeof(double));
+        }
+        if (!stream) {
+            std::cerr << "Error! Can't write model " << tmp_file << std::endl;
+            return false;
+        }
+    }
+    if (std::rename(tmp_file.c_str(), model_file.c_str()) != 0) {
+        std::cerr << "Error! Can't write model " << model_file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+TMappedModel::TMappedModel(const std::string& model_file) :
+    data_(nullptr),
+    size_(0),
+    weights_(),
+    extractor_version_(0)
+{
+    int fd = open(model_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error! Can't open model " << model_file << std::endl;
+        return;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(TModelFileHeader))
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // mapping stays valid after descriptor is closed
+    close(fd);
+    if (data == MAP_FAILED) {
+        std::cerr << "Error! Can't map model " << model_file << std::endl;
+        return;
+    }
+    size_t size = st.st_size;
+
+    TModelFileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    size_t row_size = header.nr_feature + (header.bias >= 0 ? 1 : 0);
+    bool valid = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                 header.version == FORMAT_VERSION &&
+                 header.byte_order == BYTE_ORDER_TAG &&
+                 header.nr_class > 0 &&
+                 header.nr_w > 0 && header.nr_w <= static_cast<uint64_t>(header.nr_class) &&
+                 header.w_stride >= row_size &&
+                 header.labels_offset % sizeof(int32_t) == 0 &&
+                 header.labels_offset + header.nr_class * sizeof(int32_t) <= size &&
+                 header.weights_offset % ALIGNMENT == 0 &&
+                 header.weights_offset <= size &&
+                 header.nr_w * header.w_stride <= (size - header.weights_offset) / sizeof(double);
+    if (!valid) {
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version != FORMAT_VERSION)
+            std::cerr << "Error! " << model_file << " has binary format version " << header.version
+                      << " instead of " << FORMAT_VERSION << ", convert it again" << std::endl;
+        else
+            std::cerr << "Error! " << model_file << " is not a valid binary model" << std::endl;
+        munmap(data, size);
+        return;
+    }
+
+    data_ = data;
+    size_ = size;
+    const char* bytes = static_cast<const char *>(data);
+    weights_.solver_type = header.solver_type;
+    weights_.nr_class = header.nr_class;
+    weights_.nr_w = header.nr_w;
+    weights_.nr_feature = header.nr_feature;
+    weights_.bias = header.bias;
+    weights_.label = reinterpret_cast<const int *>(bytes + header.labels_offset);
+    weights_.w = reinterpret_cast<const double *>(bytes + header.weights_offset);
+    weights_.w_stride = header.w_stride;
+    extractor_version_ = header.extractor_version;
+}
+
+TMappedModel::~TMappedModel()
+{
+    if (data_)
+        munmap(data_, size_);
+}
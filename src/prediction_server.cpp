@@ -0,0 +1,293 @@
+#include "prediction_server.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+/// Raw images larger than that are rejected instead of allocated
+constexpr size_t MAX_RAW_PIXELS = size_t(1) << 26;
+
+/// Buffered reading of lines and binary blocks from file descriptor
+class TFdReader {
+ public:
+    explicit TFdReader(int fd): fd_(fd), buffer_(), begin_(0) {}
+
+        // Read line without '\n' (and '\r'). Returns false at end of input
+        // if nothing was read.
+    bool ReadLine(std::string* line)
+    {
+        line->clear();
+        for (;;) {
+            const char* data = buffer_.data() + begin_;
+            const char* end = buffer_.data() + buffer_.size();
+            const char* eol = static_cast<const char*>(std::memchr(data, '\n', end - data));
+            if (eol) {
+                line->append(data, eol);
+                begin_ += eol - data + 1;
+                break;
+            }
+            line->append(data, end);
+            begin_ = buffer_.size();
+            if (!Fill())
+                return !line->empty();
+        }
+        if (!line->empty() && line->back() == '\r')
+            line->pop_back();
+        return true;
+    }
+
+        // Read exactly 'size' bytes
+    bool ReadBytes(size_t size, uint8_t* out)
+    {
+        while (size > 0) {
+            if (begin_ == buffer_.size() && !Fill())
+                return false;
+            size_t chunk = std::min(size, buffer_.size() - begin_);
+            std::memcpy(out, buffer_.data() + begin_, chunk);
+            begin_ += chunk;
+            out += chunk;
+            size -= chunk;
+        }
+        return true;
+    }
+
+ private:
+        // Replace consumed buffer by next portion of input
+    bool Fill()
+    {
+        buffer_.resize(BUFFER_SZ);
+        begin_ = 0;
+        for (;;) {
+            ssize_t got = read(fd_, &buffer_[0], buffer_.size());
+            if (got < 0 && errno == EINTR)
+                continue;
+            buffer_.resize(got > 0 ? got : 0);
+            return got > 0;
+        }
+    }
+
+    static constexpr size_t BUFFER_SZ = 1 << 16;
+    int fd_;
+    std::string buffer_;
+    size_t begin_;
+};
+
+bool writeAll(int fd, const std::string& data)
+{
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t put = write(fd, data.data() + done, data.size() - done);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return false;
+        done += put;
+    }
+    return true;
+}
+
+std::future<std::string> readyReply(const std::string& reply)
+{
+    std::promise<std::string> promise;
+    promise.set_value(reply);
+    return promise.get_future();
+}
+
+}
+
+TPredictionServer::TPredictionServer(const TModel& model, TExtractor extractor, size_t dim,
+                                     ThreadPool& pool, size_t max_batch) :
+    model_(model),
+    classifier_(TClassifierParams()),
+    extractor_(extractor),
+    dim_(dim),
+    pool_(pool),
+    max_batch_(max_batch ? max_batch : 1),
+    queue_(2 * max_batch_),
+    batcher_()
+{
+        // EasyBMP prints warnings to stdout, which is reply stream of stdin mode
+    SetEasyBMPwarningsOff();
+    batcher_ = std::thread([this] { BatchLoop(); });
+}
+
+TPredictionServer::~TPredictionServer()
+{
+    queue_.close();
+    batcher_.join();
+}
+
+void TPredictionServer::BatchLoop()
+{
+    std::vector<std::unique_ptr<TRequest>> batch;
+    std::unique_ptr<TRequest> request;
+    while (queue_.pop(request)) {
+        batch.clear();
+        batch.push_back(std::move(request));
+            // take what has been queued meanwhile, don't wait for more
+        while (batch.size() < max_batch_ && queue_.try_pop(request))
+            batch.push_back(std::move(request));
+        ProcessBatch(&batch);
+    }
+}
+
+void TPredictionServer::ProcessBatch(std::vector<std::unique_ptr<TRequest>>* batch)
+{
+    const size_t batch_sz = batch->size();
+    TFeatureMatrix features(batch_sz, dim_);
+    std::vector<std::string> errors(batch_sz);
+
+    pool_.parallel_for(batch_sz, [this, batch, &features, &errors](size_t idx) {
+        TRequest& request = *(*batch)[idx];
+        try {
+            if (!request.image) {
+                std::vector<uint8_t> buffer;
+                if (!ReadFileBytes(request.path, &buffer)) {
+                    errors[idx] = "can't read " + request.path;
+                    return;
+                }
+                request.image.reset(new TImage());
+                if (!DecodeBmp(buffer, request.path, request.image.get())) {
+                    errors[idx] = "can't decode " + request.path;
+                    return;
+                }
+            }
+            extractor_(*request.image, features.Row(idx));
+        } catch (const std::exception& e) {
+            errors[idx] = e.what();
+        } catch (const std::string& e) {
+            errors[idx] = e;
+        } catch (...) {
+            errors[idx] = "unknown error";
+        }
+        request.image.reset();
+    });
+
+        // failed rows are zero, their labels are dropped
+    TLabels labels;
+    if (!classifier_.Predict(features, model_, &labels)) {
+        labels.assign(batch_sz, 0);
+        for (size_t idx = 0; idx < batch_sz; ++idx)
+            if (errors[idx].empty())
+                errors[idx] = "model doesn't match descriptors of " + std::to_string(dim_) + " features";
+    }
+    for (size_t idx = 0; idx < batch_sz; ++idx) {
+        if (errors[idx].empty())
+            (*batch)[idx]->reply.set_value(std::to_string(labels[idx]));
+        else
+            (*batch)[idx]->reply.set_value("ERROR " + errors[idx]);
+    }
+}
+
+void TPredictionServer::ServeStream(int in_fd, int out_fd)
+{
+        // replies are written in request order while next requests are read
+    BoundedQueue<std::future<std::string>> replies(4 * max_batch_);
+    std::thread writer([&replies, out_fd] {
+        std::future<std::string> reply;
+        bool ok = true;
+        while (replies.pop(reply)) {
+            std::string line = reply.get() + "\n";
+                // after failed write keep draining, client is gone
+            ok = ok && writeAll(out_fd, line);
+        }
+    });
+
+    TFdReader reader(in_fd);
+    std::string line;
+    while (reader.ReadLine(&line)) {
+        if (line.empty())
+            continue;
+        std::unique_ptr<TRequest> request(new TRequest());
+        if (line.compare(0, 4, "RAW ") == 0) {
+            std::istringstream header(line.substr(4));
+            long long width = 0, height = 0;
+            if (!(header >> width >> height) || width <= 0 || height <= 0 ||
+                static_cast<unsigned long long>(width) * height > MAX_RAW_PIXELS) {
+                    // size of pixel block is unknown, protocol can't be resynchronized
+                replies.push(readyReply("ERROR bad raw image header"));
+                break;
+            }
+            std::vector<uint8_t> pixels(width * height * 3);
+            if (!reader.ReadBytes(pixels.size(), pixels.data())) {
+                replies.push(readyReply("ERROR truncated raw image"));
+                break;
+            }
+            request->image.reset(new TImage(ImageFromRgb(pixels.data(), height, width)));
+        } else {
+            request->path = line;
+        }
+        replies.push(request->reply.get_future());
+        queue_.push(std::move(request));
+    }
+    replies.close();
+    writer.join();
+}
+
+bool TPredictionServer::ServeSocket(const std::string& socket_path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error! Socket path " << socket_path << " is too long" << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        std::cerr << "Error! Can't create socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+        // socket file of previous run
+    unlink(socket_path.c_str());
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        std::cerr << "Error! Can't listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        close(listen_fd);
+        return false;
+    }
+        // client which disconnects early must not kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+
+        // clients are detached, the last one to finish signals it
+    std::mutex clients_mutex;
+    std::condition_variable clients_done;
+    size_t active_clients = 0;
+    for (;;) {
+        int client_fd = accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::cerr << "Error! Can't accept client: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            ++active_clients;
+        }
+        std::thread([this, client_fd, &clients_mutex, &clients_done, &active_clients] {
+            ServeStream(client_fd, client_fd);
+            close(client_fd);
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            if (--active_clients == 0)
+                clients_done.notify_all();
+        }).detach();
+    }
+    close(listen_fd);
+    std::unique_lock<std::mutex> lock(clients_mutex);
+    clients_done.wait(lock, [&active_clients] { return active_clients == 0; });
+    return false;
+}
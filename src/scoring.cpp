@@ -0,0 +1,110 @@
+#include "scoring.h"
+#include "simd.h"
+
+#include <algorithm>
+
+namespace {
+
+/// Dot products of 4 float rows with one double weight vector:
+/// out[s] = sum_j rows[s][j] * w[j], j < n.
+typedef void (*DotRows4Fn)(const float* const rows[4], const double* w, size_t n, double out[4]);
+
+void dotRows4Scalar(const float* const rows[4], const double* w, size_t n, double out[4])
+{
+    double acc[4] = {0, 0, 0, 0};
+    for (size_t j = 0; j < n; ++j) {
+        for (int s = 0; s < 4; ++s)
+            acc[s] += rows[s][j] * w[j];
+    }
+    std::copy(acc, acc + 4, out);
+}
+
+#ifdef SIMD_X86
+
+__attribute__((target("sse2")))
+void dotRows4Sse2(const float* const rows[4], const double* w, size_t n, double out[4])
+{
+    __m128d acc[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    size_t j = 0;
+    for (; j + 2 <= n; j += 2) {
+        __m128d vw = _mm_loadu_pd(w + j);
+        for (int s = 0; s < 4; ++s) {
+            // two floats into low half: movq load of integer vector, which may alias anything
+            __m128 pair = _mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[s] + j)));
+            __m128d x = _mm_cvtps_pd(pair);
+            acc[s] = _mm_add_pd(acc[s], _mm_mul_pd(x, vw));
+        }
+    }
+    for (int s = 0; s < 4; ++s) {
+        double lanes[2];
+        _mm_storeu_pd(lanes, acc[s]);
+        out[s] = lanes[0] + lanes[1];
+        for (size_t k = j; k < n; ++k)
+            out[s] += rows[s][k] * w[k];
+    }
+}
+
+__attribute__((target("avx2")))
+void dotRows4Avx2(const float* const rows[4], const double* w, size_t n, double out[4])
+{
+    __m256d acc[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd()};
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m256d vw = _mm256_loadu_pd(w + j);
+        for (int s = 0; s < 4; ++s) {
+            __m256d x = _mm256_cvtps_pd(_mm_loadu_ps(rows[s] + j));
+            acc[s] = _mm256_add_pd(acc[s], _mm256_mul_pd(x, vw));
+        }
+    }
+    for (int s = 0; s < 4; ++s) {
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc[s]);
+        out[s] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (size_t k = j; k < n; ++k)
+            out[s] += rows[s][k] * w[k];
+    }
+}
+#endif
+
+DotRows4Fn selectDotRows4()
+{
+#ifdef SIMD_X86
+    if (cpuHasAvx2())
+        return dotRows4Avx2;
+    if (cpuHasSse2())
+        return dotRows4Sse2;
+#endif
+    return dotRows4Scalar;
+}
+
+/// Features per chunk: 4 rows of floats and one weight vector of doubles
+/// take 64KB, so rows stay in L2 while all classes are scored
+constexpr size_t CHUNK_SZ = 2048;
+
+}
+
+void ScoreDense(const TFeatureMatrix& features, const double* weights, size_t w_stride,
+                size_t nr_w, size_t n, double* dec)
+{
+    static const DotRows4Fn dotRows4 = selectDotRows4();
+
+    const size_t number_of_samples = features.Size();
+    for (size_t s0 = 0; s0 < number_of_samples; s0 += 4) {
+        const size_t block_sz = std::min<size_t>(4, number_of_samples - s0);
+            // incomplete block: repeat the last row, its extra results are dropped
+        const float* rows[4];
+        for (size_t s = 0; s < 4; ++s)
+            rows[s] = features.Row(s0 + std::min(s, block_sz - 1));
+
+        for (size_t k0 = 0; k0 < n; k0 += CHUNK_SZ) {
+            const size_t chunk_sz = std::min(CHUNK_SZ, n - k0);
+            const float* chunk_rows[4] = {rows[0] + k0, rows[1] + k0, rows[2] + k0, rows[3] + k0};
+            for (size_t c = 0; c < nr_w; ++c) {
+                double out[4];
+                dotRows4(chunk_rows, weights + c * w_stride + k0, chunk_sz, out);
+                for (size_t s = 0; s < block_sz; ++s)
+                    dec[(s0 + s) * nr_w + c] += out[s];
+            }
+        }
+    }
+}
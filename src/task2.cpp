@@ -5,6 +5,11 @@
 #include <iostream>
 #include <cmath>
 #include <limits>
+#include <cstdlib>
+#include <cerrno>
+#include <memory>
+#include <thread>
+#include <stdexcept>
 
 #include "classifier.h"
 #include "EasyBMP.h"
@@ -12,6 +17,13 @@
 #include "argvparser.h"
 
 #include "Usable.h"
+#include "integral_image.h"
+#include "image_context.h"
+#include "decoder.h"
+#include "thread_pool.h"
+#include "bounded_queue.h"
+#include "feature_cache.h"
+#include "prediction_server.h"
 
 #ifdef DEBUG
 #include <glog/logging.h>
@@ -31,9 +43,7 @@ using std::endl;
 
 using CommandLineProcessing::ArgvParser;
 
-typedef vector<pair<BMP*, int> > TDataSet;
 typedef vector<pair<string, int> > TFileList;
-typedef vector<pair<vector<float>, int> > TFeatures;
 
 // Load list of files and its labels from 'data_file' and
 // stores it in 'file_list'
@@ -58,18 +68,6 @@ void LoadFileList(const string& data_file, TFileList* file_list) {
     stream.close();
 }
 
-// Load images by list of files 'file_list' and store them in 'data_set'
-void LoadImages(const TFileList& file_list, TDataSet* data_set) {
-    for (size_t img_idx = 0; img_idx < file_list.size(); ++img_idx) {
-            // Create image
-        BMP* image = new BMP();
-            // Read image from file
-        image->ReadFromFile(file_list[img_idx].first.c_str());
-            // Add image and it's label to dataset
-        data_set->push_back(make_pair(image, file_list[img_idx].second));
-    }
-}
-
 // Save result of prediction to file
 void SavePredictions(const TFileList& file_list,
                      const TLabels& labels, 
@@ -89,54 +87,44 @@ void SavePredictions(const TFileList& file_list,
 
 constexpr uint8_t N_SQUARES_PER_LINE = 8;
 constexpr uint8_t HIST_SZ = 8;
-
-/// assume same-sized matrixes as params
-std::vector<double> calcHistogramHog(const Matrix<double> &square,
-                                     const Matrix<double> &abs,
-                                     const Matrix<double> &angles)
+/// Soft binning splits gradient between two nearest orientation bins
+constexpr OrientationBinning HOG_BINNING = OrientationBinning::Hard;
+constexpr uint N_SQUARES = N_SQUARES_PER_LINE * N_SQUARES_PER_LINE;
+/// see LbpMode, Uniform keeps the structure with 59 bins instead of 256
+constexpr LbpMode LBP_MODE = LbpMode::Uniform;
+constexpr uint LBP_HIST_SZ = lbpBins(LBP_MODE);
+constexpr uint COLOR_HIST_SZ = 3;
+/// sizes of descriptors, they are known before any image is seen
+constexpr size_t HOG_DESC_SZ = N_SQUARES * HIST_SZ;
+constexpr size_t LBP_DESC_SZ = N_SQUARES * LBP_HIST_SZ;
+constexpr size_t COLOR_DESC_SZ = N_SQUARES * COLOR_HIST_SZ;
+constexpr size_t DESC_SZ = HOG_DESC_SZ + LBP_DESC_SZ + COLOR_DESC_SZ;
+/// Increase it on every change of descriptors, so that stale feature caches are dropped
+/// and models trained on old descriptors are refused
+constexpr uint32_t EXTRACTOR_VERSION = 2;
+
+/// Key of extractor configuration for feature cache
+uint64_t FeatureConfigKey()
 {
-    std::vector<double> hist(HIST_SZ, static_cast<double>(0));
-    for (uint i = 0; i < square.n_rows; i++) {
-        for (uint j = 0; j < square.n_cols; j++) {
-            double tmpIdx = (static_cast<double>(M_PI) + angles(i, j)) * HIST_SZ / 2 / M_PI;
-            uint idx = uint(tmpIdx) % HIST_SZ;
-            hist[idx] += abs(i, j);
-        }
-    }
-    return hist;
+    const uint32_t config[] = {EXTRACTOR_VERSION, N_SQUARES_PER_LINE, HIST_SZ,
+                               static_cast<uint32_t>(HOG_BINNING), static_cast<uint32_t>(LBP_MODE)};
+    return HashBytes(reinterpret_cast<const uint8_t *>(config), sizeof(config));
 }
 
-std::vector<double> calcHistogramLbp(const Matrix<double> &square)
+/// histogram of square slice of LBP code image, codes are binned according to mode
+std::vector<double> calcHistogramLbp(const Neighbourhood<uint8_t> &codes, LbpMode mode)
 {
-    constexpr auto LBP_HIST_SZ = 256;
-    auto matrix = square.unary_map(CompareOp<double>{});
-    std::vector<double> hist(LBP_HIST_SZ, static_cast<double>(0));
-    for (uint i = 0; i < matrix.n_rows; i++) {
-        for (uint j = 0; j < matrix.n_cols; j++) {
-            hist[matrix(i, j)]++;
+    const uint8_t *lut = lbpLut(mode);
+    std::vector<double> hist(lbpBins(mode), static_cast<double>(0));
+    for (uint i = 0; i < codes.n_rows; i++) {
+        const uint8_t *line = codes.row(i);
+        for (uint j = 0; j < codes.n_cols; j++) {
+            hist[lut[line[j]]]++;
         }
     }
     return hist;
 }
 
-std::vector<double> calcHistogramColor(const Matrix<std::tuple<uint, uint, uint>> &square)
-{
-    double r = 0, g = 0, b = 0;
-
-    for (uint i = 0; i < square.n_rows; i++) {
-        for (uint j = 0; j < square.n_cols; j++) {
-            r += std::get<0>(square(i, j));
-            g += std::get<1>(square(i, j));
-            b += std::get<2>(square(i, j));
-        }
-    }
-    r /= square.n_rows * square.n_cols * 255;
-    g /= square.n_rows * square.n_cols * 255;
-    b /= square.n_rows * square.n_cols * 255;
-    return std::vector<double>{r, g, b};
-}
-
-
 void normaliseHist(vector<double> &hist)
 {
     double norm = 0;
@@ -151,147 +139,176 @@ void normaliseHist(vector<double> &hist)
     }
 }
 
-std::vector<float> calculateHog(BMP &img)
+/// writes HOG_DESC_SZ values to desc
+void calculateHog(TImageContext &ctx, float *desc)
 {
-    auto n = static_cast<uint>(img.TellHeight());
-    auto m = static_cast<uint>(img.TellWidth());
-    n = n + (n % N_SQUARES_PER_LINE ? N_SQUARES_PER_LINE - n % N_SQUARES_PER_LINE : 0);
-    m = m + (m % N_SQUARES_PER_LINE ? N_SQUARES_PER_LINE - m % N_SQUARES_PER_LINE : 0);
-
-    // part1
-    auto imgMatrix = extraMatrix(grayscale(img), n, m);
-
-    // part2: Sobel convolution
-    auto xProj = sobel_x(imgMatrix);
-    auto yProj = sobel_y(imgMatrix);
-
-    // part3: calculate gradients
-    /// gradients absolute values
-    Matrix<double> abs(n, m);
-    /// gradients directions
-    Matrix<double> angles(n, m);
-    for (uint i = 0; i < n; i++) {
-        for (uint j = 0; j < m; j++) {
-            abs(i, j) = std::sqrt(std::pow(xProj(i, j), 2) + std::pow(yProj(i, j), 2));
-            angles(i, j) = std::atan2(yProj(i,j), xProj(i, j));
-        }
-    }
-
-    // part4: calculate histograms
-    assert(n >= N_SQUARES_PER_LINE);
-    assert(m >= N_SQUARES_PER_LINE);
+    // part1-3: padded grayscale, Sobel gradients and orientation bins
+    // part4: calculate histograms, every cell takes four lookups per bin
+    const auto &integrals = ctx.OrientationIntegrals();
+    std::vector<double> hist(HIST_SZ);
     // iterate over squares
-    std::vector<float> desc;
-    for (uint i = 0, iStep = n / N_SQUARES_PER_LINE; i + iStep <= n; i += iStep) {
-        for (uint j = 0, jStep = m / N_SQUARES_PER_LINE; j + jStep <= m; j += jStep) {
-            auto hist = calcHistogramHog(imgMatrix.submatrix(i, j, iStep, jStep),
-                                         abs.submatrix(i, j, iStep, jStep),
-                                         angles.submatrix(i, j, iStep, jStep));
-            // part5: normalise hists
-            normaliseHist(hist);
-            // part6: concatenate
-            desc.insert(desc.end(), hist.begin(), hist.end());
-        }
-    }
-    return desc;
+    ctx.Grid().ForEachCell([&](uint i, uint j, uint iStep, uint jStep) {
+        integrals.sum(i, j, iStep, jStep, hist.data());
+        // part5: normalise hists
+        normaliseHist(hist);
+        // part6: concatenate
+        desc = std::copy(hist.begin(), hist.end(), desc);
+    });
 }
 
-std::vector<float> calculateLbp(BMP &img)
+/// writes N_SQUARES * lbpBins(mode) values to desc
+void calculateLbp(TImageContext &ctx, LbpMode mode, float *desc)
 {
-    auto n = static_cast<uint>(img.TellHeight());
-    auto m = static_cast<uint>(img.TellWidth());
-    n = n + (n % N_SQUARES_PER_LINE ? N_SQUARES_PER_LINE - n % N_SQUARES_PER_LINE : 0);
-    m = m + (m % N_SQUARES_PER_LINE ? N_SQUARES_PER_LINE - m % N_SQUARES_PER_LINE : 0);
-
-    auto imgMatrix = extraMatrix(grayscale(img), n, m);
-
-    // calculate histograms
-    assert(n >= N_SQUARES_PER_LINE);
-    assert(m >= N_SQUARES_PER_LINE);
+    // codes of all pixels at once, cells only count them
+    const auto &codes = ctx.LbpCodes();
     // iterate over squares
-    std::vector<float> desc;
-    for (uint i = 0, iStep = n / N_SQUARES_PER_LINE; i + iStep <= n; i += iStep) {
-        for (uint j = 0, jStep = m / N_SQUARES_PER_LINE; j + jStep <= m; j += jStep) {
-            auto hist = calcHistogramLbp(imgMatrix.submatrix(i, j, iStep, jStep));
-            // part5: normalise hists
-            normaliseHist(hist);
-            // part6: concatenate
-            desc.insert(desc.end(), hist.begin(), hist.end());
-        }
-    }
-    return desc;
+    ctx.Grid().ForEachCell([&](uint i, uint j, uint iStep, uint jStep) {
+        auto hist = calcHistogramLbp(codes.window(i, j, iStep, jStep), mode);
+        // part5: normalise hists
+        normaliseHist(hist);
+        // part6: concatenate
+        desc = std::copy(hist.begin(), hist.end(), desc);
+    });
 }
 
-std::vector<float> calculateColor(BMP &img)
+/// writes COLOR_DESC_SZ values to desc
+void calculateColor(TImageContext &ctx, float *desc)
 {
-    auto n = static_cast<uint>(img.TellHeight());
-    auto m = static_cast<uint>(img.TellWidth());
-    n = n + (n % N_SQUARES_PER_LINE ? N_SQUARES_PER_LINE - n % N_SQUARES_PER_LINE : 0);
-    m = m + (m % N_SQUARES_PER_LINE ? N_SQUARES_PER_LINE - m % N_SQUARES_PER_LINE : 0);
+    // part1: channel sums in one pass over planes
+    static_assert(COLOR_HIST_SZ == decltype(TImage::rgb)::n_channels, "one color bin per channel");
+    const auto &integrals = ctx.ColorIntegrals();
+
+    // iterate over squares: mean of every channel scaled to [0, 1]
+    uint64_t sums[COLOR_HIST_SZ];
+    ctx.Grid().ForEachCell([&](uint i, uint j, uint iStep, uint jStep) {
+        integrals.sum(i, j, iStep, jStep, sums);
+        for (uint c = 0; c < COLOR_HIST_SZ; c++) {
+            double mean = static_cast<double>(sums[c]);
+            mean /= iStep * jStep * 255;
+            *desc++ = mean;
+        }
+    });
+}
 
-    // part1
-    auto imgMatrix = extraMatrix(origin(img), n, m);
+/// Part of descriptor: extractor takes nodes it needs from context and
+/// writes size values.
+struct TDescriptorPart {
+    size_t size;
+    void (*extract)(TImageContext &ctx, float *desc);
+};
+
+/// Parts of descriptor in order of concatenation. To add a descriptor
+/// write its extractor, add it here and count its size in DESC_SZ.
+const TDescriptorPart DESCRIPTOR_PARTS[] = {
+    {HOG_DESC_SZ, calculateHog},
+    {LBP_DESC_SZ, [](TImageContext &ctx, float *desc) { calculateLbp(ctx, LBP_MODE, desc); }},
+    {COLOR_DESC_SZ, calculateColor},
+};
 
-    // iterate over squares
-    std::vector<float> desc;
-    for (uint i = 0, iStep = n / N_SQUARES_PER_LINE; i + iStep <= n; i += iStep) {
-        for (uint j = 0, jStep = m / N_SQUARES_PER_LINE; j + jStep <= m; j += jStep) {
-            auto hist = calcHistogramColor(imgMatrix.submatrix(i, j, iStep, jStep));
-            desc.insert(desc.end(), hist.begin(), hist.end());
-        }
+/**
+ * Build descriptor of one image: concatenated parts of DESCRIPTOR_PARTS
+ * (HOG, LBP and color histograms), which share intermediates of the image.
+ * Writes DESC_SZ values to desc. Thread-safe for different images.
+ */
+void ExtractDescriptor(const TImage &img, float *desc)
+{
+    TImageContext ctx(img, N_SQUARES_PER_LINE, HIST_SZ, HOG_BINNING);
+    float *end = desc;
+    for (const auto &part : DESCRIPTOR_PARTS) {
+        part.extract(ctx, end);
+        end += part.size;
     }
-    return desc;
+    assert(end == desc + DESC_SZ);
 }
 
 /**
- * Extract features from dataset.
- * @param data_set vector of pairs <image, lable>
- * @param features vector of gistograms and lables for images from data_set.
- *                  The main aim of the function is to construct that vector.
+ * Load images and extract features from them in a pipeline:
+ * decoding thread -> queue of at most queue_depth images -> workers of pool -> features.
+ * Image is deleted as soon as its descriptor is built, so number of images
+ * in memory is bounded by queue_depth + pool.size() instead of size of dataset,
+ * and reading files overlaps with computations.
+ * @param file_list list of image files and their labels
+ * @param features row of every image is preallocated,
+ *                  order of features matches file_list.
+ * @param cache if not null, images found in cache (by content) are not decoded at all,
+ *              descriptors of other images are added to cache.
+ * @throws std::runtime_error if some image file can't be read or decoded.
  */
-void ExtractFeatures(const TDataSet& data_set, TFeatures* features)
+void ExtractFeaturesStreaming(const TFileList& file_list, TFeatureMatrix* features,
+                              ThreadPool &pool, size_t queue_depth, TFeatureCache *cache)
 {
-    for (const auto &elem : data_set) {
-        auto &img = *(elem.first);  // reference is not const because of BMP class architecture
-        const auto &label = elem.second;
-
-        // check input
-        assert(img.TellHeight() <= static_cast<long long int>(std::numeric_limits<uint>::max()) && img.TellHeight() >= 0);
-        assert(img.TellWidth() <= static_cast<long long int>(std::numeric_limits<uint>::max()) && img.TellWidth() >= 0);
-
-        auto hogDesc = calculateHog(img);
-        auto lbpDesc = calculateLbp(img);
-        auto colorDesc = calculateColor(img);
-
-        std::vector<float> desc;
-        desc.insert(desc.end(), hogDesc.begin(), hogDesc.end());
-        desc.insert(desc.end(), lbpDesc.begin(), lbpDesc.end());
-        desc.insert(desc.end(), colorDesc.begin(), colorDesc.end());
-        features->emplace_back(std::make_pair(desc, label));
+    struct TDecodedImage {
+        size_t idx;
+        uint64_t contentHash;
+        std::unique_ptr<TImage> image;
+    };
+    BoundedQueue<TDecodedImage> queue(queue_depth);
+    features->Resize(file_list.size(), DESC_SZ);
+
+    // decode stage
+    std::exception_ptr decodeError;
+    std::thread decoder([&file_list, &queue, &decodeError, features, cache] {
+        try {
+            std::vector<uint8_t> buffer;
+            for (size_t idx = 0; idx < file_list.size(); ++idx) {
+                    // buffer is reused, so failed read must not fall through to previous image
+                if (!ReadFileBytes(file_list[idx].first, &buffer))
+                    throw std::runtime_error("Can't read image " + file_list[idx].first);
+                uint64_t contentHash = HashBytes(buffer.data(), buffer.size());
+                features->Label(idx) = file_list[idx].second;
+                if (cache && cache->Lookup(contentHash, features->Row(idx), features->Dim()))
+                    continue;
+                std::unique_ptr<TImage> image(new TImage());
+                if (!DecodeBmp(buffer, file_list[idx].first, image.get()))
+                    throw std::runtime_error("Can't decode image " + file_list[idx].first);
+                if (!queue.push(TDecodedImage{idx, contentHash, std::move(image)}))
+                    break;  // feature stage has failed
+            }
+        } catch (...) {
+            decodeError = std::current_exception();
+        }
+        queue.close();
+    });
+
+    // feature stage
+    for (uint worker = 0; worker < pool.size(); ++worker) {
+        pool.submit([&queue, features, cache] {
+            try {
+                TDecodedImage item;
+                while (queue.pop(item)) {
+                    float *desc = features->Row(item.idx);
+                    ExtractDescriptor(*item.image, desc);
+                    item.image.reset();
+                    if (cache)
+                        cache->Insert(item.contentHash, desc, features->Dim());
+                }
+            } catch (...) {
+                // stop decoder, otherwise it can block on full queue forever
+                queue.close();
+                throw;
+            }
+        });
     }
+
+    decoder.join();
+    pool.wait();
+    if (decodeError)
+        std::rethrow_exception(decodeError);
+    if (cache)
+        cache->Save();
 }
 
 //**********************************End of my code********************************************
 
 
-// Clear dataset structure
-void ClearDataset(TDataSet* data_set) {
-        // Delete all images from dataset
-    for (size_t image_idx = 0; image_idx < data_set->size(); ++image_idx)
-        delete (*data_set)[image_idx].first;
-        // Clear dataset
-    data_set->clear();
-}
-
 // Train SVM classifier using data from 'data_file' and save trained model
-// to 'model_file'
-void TrainClassifier(const string& data_file, const string& model_file) {
+// to 'model_file'. Returns false if model can't be saved
+bool TrainClassifier(const string& data_file, const string& model_file,
+                     ThreadPool &pool, TFeatureCache *cache) {
         // List of image file names and its labels
     TFileList file_list;
-        // Structure of images and its labels
-    TDataSet data_set;
         // Structure of features of images and its labels
-    TFeatures features;
+    TFeatureMatrix features;
         // Model which would be trained
     TModel model;
         // Parameters of classifier
@@ -299,60 +316,92 @@ void TrainClassifier(const string& data_file, const string& model_file) {
     
         // Load list of image file names and its labels
     LoadFileList(data_file, &file_list);
-        // Load images
-    LoadImages(file_list, &data_set);
-        // Extract features from images
-    ExtractFeatures(data_set, &features);
+        // Load images and extract features from them
+    ExtractFeaturesStreaming(file_list, &features, pool, 2 * pool.size(), cache);
 
         // PLACE YOUR CODE HERE
         // You can change parameters of classifier here
     params.C = 0.01;
+    params.nr_thread = static_cast<int>(pool.size());
     TClassifier classifier(params);
 
         // Train classifier
     classifier.Train(features, &model);
 
         // Save model to file
-    model.Save(model_file);
-        // Clear dataset structure
-    ClearDataset(&data_set);
+    model.SetExtractorVersion(EXTRACTOR_VERSION);
+    return model.Save(model_file);
+}
+
+// Load model from 'model_file' to predict with descriptors of this program.
+// Prints error and returns false if model can't be loaded or was trained on
+// descriptors of other dimension or other extractor version
+bool LoadModel(const string& model_file, TModel* model) {
+    model->Load(model_file);
+    if (!model->Weights().w) {
+        cerr << "Error! Can't load model " << model_file << endl;
+        return false;
+    }
+    if (model->Weights().nr_feature != DESC_SZ) {
+        cerr << "Error! Model " << model_file << " has " << model->Weights().nr_feature
+             << " features, but descriptors have " << DESC_SZ << ", retrain it" << endl;
+        return false;
+    }
+    if (model->ExtractorVersion() != EXTRACTOR_VERSION) {
+        cerr << "Error! Model " << model_file << " was trained with extractor version "
+             << model->ExtractorVersion() << " (0 is unknown), current version is "
+             << EXTRACTOR_VERSION << ", retrain it" << endl;
+        return false;
+    }
+    return true;
 }
 
 // Predict data from 'data_file' using model from 'model_file' and
-// save predictions to 'prediction_file'
-void PredictData(const string& data_file,
+// save predictions to 'prediction_file'. Returns false if model can't be used
+bool PredictData(const string& data_file,
                  const string& model_file,
-                 const string& prediction_file) {
+                 const string& prediction_file,
+                 ThreadPool &pool, TFeatureCache *cache) {
         // List of image file names and its labels
     TFileList file_list;
-        // Structure of images and its labels
-    TDataSet data_set;
         // Structure of features of images and its labels
-    TFeatures features;
+    TFeatureMatrix features;
         // List of image labels
     TLabels labels;
 
-        // Load list of image file names and its labels
-    LoadFileList(data_file, &file_list);
-        // Load images
-    LoadImages(file_list, &data_set);
-        // Extract features from images
-    ExtractFeatures(data_set, &features);
-
         // Classifier 
     TClassifier classifier = TClassifier(TClassifierParams());
         // Trained model
     TModel model;
-        // Load model from file
-    model.Load(model_file);
+        // Load model from file before time is spent on features
+    if (!LoadModel(model_file, &model))
+        return false;
+
+        // Load list of image file names and its labels
+    LoadFileList(data_file, &file_list);
+        // Load images and extract features from them
+    ExtractFeaturesStreaming(file_list, &features, pool, 2 * pool.size(), cache);
+
         // Predict images by its features using 'model' and store predictions
         // to 'labels'
-    classifier.Predict(features, model, &labels);
+    if (!classifier.Predict(features, model, &labels))
+        return false;
 
         // Save predictions
     SavePredictions(file_list, labels, prediction_file);
-        // Clear dataset structure
-    ClearDataset(&data_set);
+    return true;
+}
+
+// Parse non-negative integer value of option, the whole value must be a number
+bool ParseUint(const string& text, uint* value) {
+    char* end = NULL;
+    errno = 0;
+    long parsed = std::strtol(text.c_str(), &end, 10);
+    if (end == text.c_str() || *end != '\0' || errno == ERANGE ||
+        parsed < 0 || parsed > static_cast<long>(std::numeric_limits<uint>::max()))
+        return false;
+    *value = static_cast<uint>(parsed);
+    return true;
 }
 
 int main(int argc, char** argv) {
@@ -369,13 +418,24 @@ int main(int argc, char** argv) {
     cmd.setHelpOption("h", "help", "Print this help message");
         // Add other options
     cmd.defineOption("data_set", "File with dataset",
-        ArgvParser::OptionRequiresValue | ArgvParser::OptionRequired);
-    cmd.defineOption("model", "Path to file to save or load model",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("model", "Path to file to save or load model, text or binary",
         ArgvParser::OptionRequiresValue | ArgvParser::OptionRequired);
     cmd.defineOption("predicted_labels", "Path to file to save prediction results",
         ArgvParser::OptionRequiresValue);
     cmd.defineOption("train", "Train classifier");
     cmd.defineOption("predict", "Predict dataset");
+    cmd.defineOption("threads", "Number of threads for feature extraction and training, 0 means all cores (default 1)",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("feature_cache", "File to cache image descriptors in between runs",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("convert_model", "Convert model to binary format and save it to given file",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("serve", "Load model once and classify images requested over stdin or --socket");
+    cmd.defineOption("socket", "Unix socket to serve requests on instead of stdin",
+        ArgvParser::OptionRequiresValue);
+    cmd.defineOption("max_batch", "Maximal number of requests scored together in serve mode (default 64)",
+        ArgvParser::OptionRequiresValue);
         
         // Add options aliases
     cmd.defineOptionAlternative("data_set", "d");
@@ -398,20 +458,78 @@ int main(int argc, char** argv) {
     string model_file = cmd.optionValue("model");
     bool train = cmd.foundOption("train");
     bool predict = cmd.foundOption("predict");
+        // Dataset is needed for training and prediction only
+    if ((train || predict) && !cmd.foundOption("data_set")) {
+        cerr << "Error! Option --data_set not found!" << endl;
+        return 1;
+    }
+    uint threads = 1;
+    if (cmd.foundOption("threads")) {
+        if (!ParseUint(cmd.optionValue("threads"), &threads)) {
+            cerr << "Error! Option --threads must be a non-negative integer!" << endl;
+            return 1;
+        }
+    }
+        // Workers for feature extraction
+    ThreadPool pool(threads);
+        // Cache of descriptors
+    std::unique_ptr<TFeatureCache> cache;
+    if (cmd.foundOption("feature_cache"))
+        cache.reset(new TFeatureCache(cmd.optionValue("feature_cache"), FeatureConfigKey()));
 
         // If we need to train classifier
-    if (train)
-        TrainClassifier(data_file, model_file);
-        // If we need to predict data
-    if (predict) {
-            // You must declare file to save images
-        if (!cmd.foundOption("predicted_labels")) {
-            cerr << "Error! Option --predicted_labels not found!" << endl;
+    try {
+        if (train && !TrainClassifier(data_file, model_file, pool, cache.get()))
             return 1;
+            // If we need to predict data
+        if (predict) {
+                // You must declare file to save images
+            if (!cmd.foundOption("predicted_labels")) {
+                cerr << "Error! Option --predicted_labels not found!" << endl;
+                return 1;
+            }
+                // File to save predictions
+            string prediction_file = cmd.optionValue("predicted_labels");
+                // Predict data
+            if (!PredictData(data_file, model_file, prediction_file, pool, cache.get()))
+                return 1;
+        }
+    } catch (const std::runtime_error& error) {
+            // Unreadable image in dataset
+        cerr << "Error! " << error.what() << endl;
+        return 1;
+    }
+        // If we need to convert model
+    if (cmd.foundOption("convert_model")) {
+        TModel model;
+        model.Load(model_file);
+        if (!model.Weights().w) {
+            cerr << "Error! Can't load model " << model_file << endl;
+            return 1;
+        }
+        if (!model.SaveBinary(cmd.optionValue("convert_model")))
+            return 1;
+    }
+        // If we need to serve requests
+    if (cmd.foundOption("serve")) {
+        TModel model;
+        if (!LoadModel(model_file, &model))
+            return 1;
+        size_t max_batch = 64;
+        if (cmd.foundOption("max_batch")) {
+            uint value = 0;
+            if (!ParseUint(cmd.optionValue("max_batch"), &value) || value == 0) {
+                cerr << "Error! Option --max_batch must be a positive integer!" << endl;
+                return 1;
+            }
+            max_batch = value;
+        }
+        TPredictionServer server(model, ExtractDescriptor, DESC_SZ, pool, max_batch);
+        if (cmd.foundOption("socket")) {
+            if (!server.ServeSocket(cmd.optionValue("socket")))
+                return 1;
+        } else {
+            server.ServeStream(0, 1);
         }
-            // File to save predictions
-        string prediction_file = cmd.optionValue("predicted_labels");
-            // Predict data
-        PredictData(data_file, model_file, prediction_file);
     }
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(uint thread_count) :
+	workers_{},
+	jobs_{},
+	pending_{ 0 },
+	stopping_{ false },
+	error_{},
+	mutex_{},
+	job_cv_{},
+	done_cv_{}
+{
+	if (thread_count == 0)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+	for (uint i = 0; i < thread_count; ++i)
+		workers_.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		done_cv_.wait(lock, [this] { return pending_ == 0; });
+		stopping_ = true;
+	}
+	job_cv_.notify_all();
+	for (auto &worker : workers_)
+		worker.join();
+}
+
+uint ThreadPool::size() const
+{
+	return static_cast<uint>(workers_.size());
+}
+
+void ThreadPool::submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		jobs_.push_back(std::move(job));
+		++pending_;
+	}
+	job_cv_.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	done_cv_.wait(lock, [this] { return pending_ == 0; });
+	if (error_) {
+		std::exception_ptr error = error_;
+		error_ = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+namespace {
+
+// State of one parallel_for call. It is shared with helper jobs, because
+// they may be taken by workers after the call has returned.
+struct ParallelForState
+{
+	ParallelForState(size_t total, const std::function<void(size_t)> &fn) :
+		next{ 0 }, done{ 0 }, count{ total }, task{ &fn }, error{}, mutex{}, done_cv{}
+	{
+	}
+
+	// Next index to hand out and number of finished indices
+	std::atomic<size_t> next;
+	std::atomic<size_t> done;
+	const size_t count;
+	// Used only for indices below count, which are all taken before return
+	const std::function<void(size_t)> *task;
+	std::exception_ptr error;
+	std::mutex mutex;
+	// Signals parallel_for that all indices are finished
+	std::condition_variable done_cv;
+};
+
+// Take indices one by one until all of them are handed out
+void run_indices(ParallelForState &state)
+{
+	for (size_t idx = state.next++; idx < state.count; idx = state.next++) {
+		try {
+			(*state.task)(idx);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(state.mutex);
+			if (!state.error)
+				state.error = std::current_exception();
+		}
+		if (++state.done == state.count) {
+			std::lock_guard<std::mutex> lock(state.mutex);
+			state.done_cv.notify_all();
+		}
+	}
+}
+
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)> &task)
+{
+	if (count == 0)
+		return;
+	auto state = std::make_shared<ParallelForState>(count, task);
+	// calling thread works too, so helpers are one less than workers
+	uint helper_count = static_cast<uint>(std::min<size_t>(size(), count) - 1);
+	for (uint i = 0; i < helper_count; ++i)
+		submit([state] { run_indices(*state); });
+	run_indices(*state);
+
+	// Indices left unfinished are being run by threads which are busy with
+	// them right now, so waiting doesn't depend on queued jobs of the pool.
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->done_cv.wait(lock, [&state] { return state->done == state->count; });
+	if (state->error)
+		std::rethrow_exception(state->error);
+}
+
+void ThreadPool::worker_loop()
+{
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			job_cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+			if (jobs_.empty())
+				return;
+			job = std::move(jobs_.front());
+			jobs_.pop_front();
+		}
+		try {
+			job();
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!error_)
+				error_ = std::current_exception();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (--pending_ == 0)
+				done_cv_.notify_all();
+		}
+	}
+}